@@ -4,9 +4,18 @@
 #define DEBUG
 //#define DIFF_TEST
 
+/* Dispatch instructions with computed goto over a flattened opcode table. */
+#define THREADED_DISPATCH
+
 /* You will define this macro in PA2 */
 //#define HAS_IOE
 
+/* NEMU built as a reference model for differential testing, see `make ref' */
+#ifdef DIFF_REF
+#undef HAS_IOE
+#undef DIFF_TEST
+#endif
+
 #include "debug.h"
 #include "macro.h"
 
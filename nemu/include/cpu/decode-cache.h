@@ -0,0 +1,23 @@
+#ifndef __CPU_DECODE_CACHE_H__
+#define __CPU_DECODE_CACHE_H__
+
+#include "cpu/exec.h"
+
+typedef struct {
+  vaddr_t eip;
+  uint32_t *pgen;   // pmem_page_gen of the physical page
+  uint32_t gen;     // its value at the time of decoding
+  int len;
+  EHelper execute;  // the helper finally reached after walking the opcode tables
+  DecodeInfo info;
+} DCacheEntry;
+
+void init_dcache(void);
+void dcache_flush(void);
+void dcache_stage(EHelper);
+uint32_t dcache_gen(vaddr_t);
+void dcache_fill(vaddr_t, vaddr_t, uint32_t);
+DCacheEntry* dcache_lookup(vaddr_t);
+void dcache_load(DCacheEntry *);
+
+#endif
@@ -6,6 +6,7 @@
 #include "rtl.h"
 
 enum { OP_TYPE_REG, OP_TYPE_MEM, OP_TYPE_IMM };
+enum { OP_LOAD_NONE, OP_LOAD_REG, OP_LOAD_MEM };
 
 #define OP_STR_SIZE 40
 
@@ -19,7 +20,16 @@ typedef struct {
     int32_t simm;
   };
   rtlreg_t val;
-  char str[OP_STR_SIZE];
+
+  /* How `addr' and `val' are obtained. They depend on the machine state,
+   * so they are recomputed when a cached decoding is replayed.
+   */
+  struct {
+    int8_t base, index;
+    uint8_t scale;
+    int32_t disp;
+  } mem;
+  uint8_t load, load_width;
 } Operand;
 
 typedef struct {
@@ -30,10 +40,9 @@ typedef struct {
   bool is_jmp;
   vaddr_t jmp_eip;
   Operand src, dest, src2;
+  uint8_t instr[15];  // raw bytes, for the instruction trace
 #ifdef DEBUG
   char assembly[80];
-  char asm_buf[128];
-  char *p;
 #endif
 } DecodeInfo;
 
@@ -63,6 +72,45 @@ void load_addr(vaddr_t *, ModR_M *, Operand *);
 void read_ModR_M(vaddr_t *, Operand *, bool, Operand *, bool);
 
 void operand_write(Operand *, rtlreg_t *);
+const char* operand_str(Operand *);
+
+static inline void operand_write_width(Operand *op, rtlreg_t* src, const int width) {
+  if (op->type == OP_TYPE_REG) { rtl_sr(op->reg, width, src); }
+  else if (op->type == OP_TYPE_MEM) { rtl_sm(&op->addr, width, src); }
+  else { assert(0); }
+}
+
+static inline void operand_load_reg(Operand *op, int width) {
+  op->load = OP_LOAD_REG;
+  op->load_width = width;
+  rtl_lr(&op->val, op->reg, width);
+}
+
+static inline void operand_load_mem(Operand *op, int width) {
+  op->load = OP_LOAD_MEM;
+  op->load_width = width;
+  rtl_lm(&op->val, &op->addr, width);
+}
+
+/* recompute the address and reload the value of an operand decoded before */
+static inline void operand_reload(Operand *op) {
+  if (op->type == OP_TYPE_MEM) {
+    rtl_li(&op->addr, op->mem.disp);
+    if (op->mem.base != -1) {
+      rtl_add(&op->addr, &op->addr, &reg_l(op->mem.base));
+    }
+    if (op->mem.index != -1) {
+      rtlreg_t index = reg_l(op->mem.index) << op->mem.scale;
+      rtl_add(&op->addr, &op->addr, &index);
+    }
+  }
+
+  switch (op->load) {
+    case OP_LOAD_REG: rtl_lr(&op->val, op->reg, op->load_width); break;
+    case OP_LOAD_MEM: rtl_lm(&op->val, &op->addr, op->load_width); break;
+    default: break;
+  }
+}
 
 /* shared by all helper functions */
 extern DecodeInfo decoding;
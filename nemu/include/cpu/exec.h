@@ -8,19 +8,40 @@ typedef void (*EHelper) (vaddr_t *);
 
 #include "cpu/decode.h"
 
+/* Define an exec helper whose body sees the operand width as the constant
+ * `width', so that width switches in RTL and operand_write_width() are
+ * folded at compile time. It is instantiated as exec_<name>_b/_w/_l, which
+ * the threaded dispatcher picks by width, and as the generic exec_<name>,
+ * which reads the width of the destination operand at run time.
+ */
+#define make_EHelperW(name) \
+  static inline __attribute__((always_inline)) void concat(exec_width_, name) (vaddr_t *, const int); \
+  make_EHelper(name) { concat(exec_width_, name) (eip, id_dest->width); } \
+  make_EHelper(concat(name, _b)) { concat(exec_width_, name) (eip, 1); } \
+  make_EHelper(concat(name, _w)) { concat(exec_width_, name) (eip, 2); } \
+  make_EHelper(concat(name, _l)) { concat(exec_width_, name) (eip, 4); } \
+  static inline void concat(exec_width_, name) (vaddr_t *eip, const int width)
+
+#define declare_EHelperW(name) \
+  make_EHelper(name); \
+  make_EHelper(concat(name, _b)); \
+  make_EHelper(concat(name, _w)); \
+  make_EHelper(concat(name, _l))
+
 static inline uint32_t instr_fetch(vaddr_t *eip, int len) {
-  uint32_t instr = vaddr_read(*eip, len);
-#ifdef DEBUG
-  uint8_t *p_instr = (void *)&instr;
-  int i;
-  for (i = 0; i < len; i ++) {
-    decoding.p += sprintf(decoding.p, "%02x ", p_instr[i]);
+  uint32_t instr = vaddr_ifetch(*eip, len);
+  uint32_t offset = *eip - cpu.eip;
+  if (offset + len <= sizeof(decoding.instr)) {
+    memcpy(decoding.instr + offset, &instr, len);
   }
-#endif
   (*eip) += len;
   return instr;
 }
 
+static inline void update_eip(void) {
+  cpu.eip = (decoding.is_jmp ? (decoding.is_jmp = 0, decoding.jmp_eip) : decoding.seq_eip);
+}
+
 void rtl_setcc(rtlreg_t*, uint8_t);
 
 static inline const char* get_cc_name(int subcode) {
@@ -34,7 +55,17 @@ static inline const char* get_cc_name(int subcode) {
 }
 
 #ifdef DEBUG
-#define print_asm(...) Assert(snprintf(decoding.assembly, 80, __VA_ARGS__) < 80, "buffer overflow!")
+/* The assembly text is only generated when it is read, i.e. printed by `si'
+ * or written to the log. Arguments are not evaluated otherwise, so operands
+ * should be rendered by operand_str() inside them.
+ */
+extern bool print_asm_enabled;
+#define print_asm(...) \
+  do { \
+    if (print_asm_enabled) { \
+      Assert(snprintf(decoding.assembly, 80, __VA_ARGS__) < 80, "buffer overflow!"); \
+    } \
+  } while (0)
 #else
 #define print_asm(...)
 #endif
@@ -42,12 +73,12 @@ static inline const char* get_cc_name(int subcode) {
 #define suffix_char(width) ((width) == 4 ? 'l' : ((width) == 1 ? 'b' : ((width) == 2 ? 'w' : '?')))
 
 #define print_asm_template1(instr) \
-  print_asm(str(instr) "%c %s", suffix_char(id_dest->width), id_dest->str)
+  print_asm(str(instr) "%c %s", suffix_char(id_dest->width), operand_str(id_dest))
 
 #define print_asm_template2(instr) \
-  print_asm(str(instr) "%c %s,%s", suffix_char(id_dest->width), id_src->str, id_dest->str)
+  print_asm(str(instr) "%c %s,%s", suffix_char(id_dest->width), operand_str(id_src), operand_str(id_dest))
 
 #define print_asm_template3(instr) \
-  print_asm(str(instr) "%c %s,%s,%s", suffix_char(id_dest->width), id_src->str, id_src2->str, id_dest->str)
+  print_asm(str(instr) "%c %s,%s,%s", suffix_char(id_dest->width), operand_str(id_src), operand_str(id_src2), operand_str(id_dest))
 
 #endif
@@ -0,0 +1,26 @@
+#ifndef __CPU_JIT_H__
+#define __CPU_JIT_H__
+
+#include "cpu/tb.h"
+
+/* The JIT emits x86-64 code which runs most instructions inline, so it
+ * can not produce the per-instruction trace or diff-test steps, nor log
+ * the stores for the reference model.
+ */
+#if defined(__x86_64__) && !defined(DEBUG) && !defined(DIFF_TEST) && !defined(DIFF_REF)
+#define HAS_JIT
+#endif
+
+/* executions before a block is compiled */
+#define JIT_HOT_THRESHOLD 64
+
+/* a compiled block returns the number of instructions it executed */
+typedef int (*JitCode) (void);
+
+extern bool jit_mode;
+
+void init_jit(void);
+void jit_flush(void);
+JitCode jit_compile(TBlock *);
+
+#endif
@@ -111,12 +111,41 @@ static inline void rtl_sr(int r, int width, const rtlreg_t* src1) {
   }
 }
 
+/* Flags are evaluated lazily. Arithmetic and logic instructions only
+ * record their operands and result with rtl_update_eflags_lazy(), and
+ * CF, OF, ZF and SF are materialized into `cpu.eflags' when they are read.
+ */
+enum {
+  LAZY_CC_NONE,   // `cpu.eflags' is up to date
+  LAZY_CC_ADD, LAZY_CC_SUB,
+  LAZY_CC_INC, LAZY_CC_DEC,  // CF is not affected
+  LAZY_CC_LOGIC,  // CF and OF are cleared
+  LAZY_CC_ZFSF    // only ZF and SF are affected
+};
+
+void eflags_materialize(void);
+
+static inline void rtl_update_eflags_lazy(uint32_t op, const rtlreg_t* src1,
+    const rtlreg_t* src2, const rtlreg_t* res, int width) {
+  if (op == LAZY_CC_INC || op == LAZY_CC_DEC || op == LAZY_CC_ZFSF) {
+    /* some flags are kept from the pending operation */
+    eflags_materialize();
+  }
+  cpu.cc.op = op;
+  cpu.cc.src1 = *src1;
+  cpu.cc.src2 = *src2;
+  cpu.cc.res = *res;
+  cpu.cc.width = width;
+}
+
 #define make_rtl_setget_eflags(f) \
   static inline void concat(rtl_set_, f) (const rtlreg_t* src) { \
-    TODO(); \
+    eflags_materialize(); \
+    cpu.eflags.f = *src; \
   } \
   static inline void concat(rtl_get_, f) (rtlreg_t* dest) { \
-    TODO(); \
+    eflags_materialize(); \
+    *dest = cpu.eflags.f; \
   }
 
 make_rtl_setget_eflags(CF)
@@ -173,12 +202,14 @@ static inline void rtl_msb(rtlreg_t* dest, const rtlreg_t* src1, int width) {
 
 static inline void rtl_update_ZF(const rtlreg_t* result, int width) {
   // eflags.ZF <- is_zero(result[width * 8 - 1 .. 0])
-  TODO();
+  eflags_materialize();
+  cpu.eflags.ZF = ((*result << ((4 - width) << 3)) == 0);
 }
 
 static inline void rtl_update_SF(const rtlreg_t* result, int width) {
   // eflags.SF <- is_sign(result[width * 8 - 1 .. 0])
-  TODO();
+  eflags_materialize();
+  cpu.eflags.SF = (*result >> ((width << 3) - 1)) & 0x1;
 }
 
 static inline void rtl_update_ZFSF(const rtlreg_t* result, int width) {
@@ -0,0 +1,65 @@
+#ifndef __CPU_TB_H__
+#define __CPU_TB_H__
+
+#include "cpu/decode-cache.h"
+
+#define MAX_TB_INSTR 64
+
+/* How an operand is prepared for the execution helper, resolved when the
+ * block is recorded. The first fields are stored into the Operand as they
+ * are, and the recipe says what is then recomputed from the machine state.
+ */
+enum {
+  TB_OP_CONST,                            // nothing depends on the machine state
+  TB_OP_REG_L, TB_OP_REG_W, TB_OP_REG_B,  // `val' is read from register `imm'
+  TB_OP_MEM,                              // `addr' is computed
+  TB_OP_MEM_LOAD                          // and `val' is read from it
+};
+
+typedef struct {
+  /* in the order of Operand */
+  uint32_t type;
+  int width;
+  uint32_t imm;         // the register, the immediate or the displacement
+  rtlreg_t val;
+
+  uint8_t recipe;
+  uint8_t load_width;
+  int8_t base, index;   // -1 if not used
+  uint8_t scale;
+} TBOperand;
+
+/* an instruction of a block, only the fields read by execution helpers */
+typedef struct {
+  EHelper execute;
+  vaddr_t seq_eip;
+  vaddr_t jmp_eip;
+  uint16_t opcode;
+  bool is_operand_size_16;
+  TBOperand src, dest, src2;
+} TBInstr;
+
+/* A translation block: the decodings of a straight-line sequence of
+ * instructions, usually ending with a control transfer.
+ */
+typedef struct TBlock {
+  vaddr_t eip;
+  uint32_t *pgen;   // pmem_page_gen of the physical page
+  uint32_t gen;     // its value at the time of translation
+  int nr_instr;
+  TBInstr *instr;
+  /* successors linked by the dispatcher: [0] jump target, [1] fall through */
+  struct TBlock *succ[2];
+  uint32_t nr_exec;
+  void *jit_code;   // compiled host code if the block is hot
+} TBlock;
+
+void init_tb(void);
+void tb_flush(void);
+TBlock* tb_lookup(vaddr_t);
+TBlock* tb_chain(TBlock *, vaddr_t);
+TBlock* tb_translate(uint64_t *);
+int tb_exec(TBlock *);
+void tb_exec_instr(const TBInstr *);
+
+#endif
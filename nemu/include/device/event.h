@@ -0,0 +1,37 @@
+#ifndef __EVENT_H__
+#define __EVENT_H__
+
+#include "common.h"
+
+/* Periodic device events. The main loop runs instructions in batches up to
+ * the earliest deadline, then fires the events that are due. Deadlines are
+ * counted in guest instructions or in microseconds of host time.
+ */
+
+enum { EVENT_ICOUNT, EVENT_HOST };
+
+typedef void(*event_handler_t)(void);
+
+/* number of guest instructions executed */
+extern uint64_t icount;
+
+/* index of the instruction being executed, for devices */
+uint64_t icount_now(void);
+void icount_adjust(int64_t);
+
+/* With --icount, guest time is derived from the instruction count at this
+ * rate, and events in host time are scheduled on that clock instead.
+ * It is 0 if guest time follows the host clock.
+ */
+#define ICOUNT_DEFAULT_MIPS 100
+extern uint32_t icount_mips;
+
+uint64_t guest_time_us(void);
+
+void add_event(event_handler_t, int, uint64_t);
+
+uint64_t event_budget(uint64_t);
+void event_advance(uint64_t);
+void event_restore(void);
+
+#endif
@@ -5,7 +5,7 @@
 
 typedef void(*mmio_callback_t)(paddr_t, int, bool);
 
-void* add_mmio_map(paddr_t, int, mmio_callback_t);
+void* add_mmio_map(const char *, paddr_t, int, mmio_callback_t);
 int is_mmio(paddr_t);
 
 uint32_t mmio_read(paddr_t, int, int);
@@ -0,0 +1,41 @@
+#ifndef __REPLAY_H__
+#define __REPLAY_H__
+
+#include "common.h"
+
+/* Record and replay of non-deterministic device input. Every such input is
+ * logged with the index of the instruction which received it, so a replayed
+ * run executes exactly the same instruction stream.
+ *
+ * The file starts with a ReplayHeader and is followed by records of a kind
+ * byte, the distance in instructions from the previous record and the value,
+ * both as LEB128 varints. RTC and cycle counter values are stored as the
+ * difference from the previous value of the kind.
+ */
+
+#define REPLAY_MAGIC 0x5052454e  // "NERP"
+#define REPLAY_VERSION 1
+
+typedef struct {
+  uint32_t magic;
+  uint32_t version;
+} ReplayHeader;
+
+enum { REPLAY_OFF, REPLAY_RECORD, REPLAY_PLAY };
+
+enum {
+  REPLAY_INTR,  // device interrupt raised before the instruction
+  REPLAY_KEY,   // scancode taken from the keyboard queue
+  REPLAY_RTC,   // value read from the RTC port
+  REPLAY_CYCLES,  // cycle count latched by the PMU in host time
+};
+
+extern int replay_mode;
+
+void init_replay(const char *, int);
+void replay_log(int, uint64_t);
+bool replay_fetch(int, uint64_t *);
+uint64_t replay_deadline(void);
+void replay_advance(void);
+
+#endif
@@ -3,16 +3,71 @@
 
 #include "common.h"
 
+#define PMEM_SIZE (128 * 1024 * 1024)
+
 extern uint8_t pmem[];
 
+/* bumped on every write to a physical page, used to invalidate the decode cache */
+extern uint32_t pmem_page_gen[];
+#define pmem_page_gen_of(p) pmem_page_gen[(unsigned)(p) >> 12]
+
+/* set on every write to a physical page, so pages which are not set still
+ * hold zeros; one byte per page to keep the store on the write path cheap
+ */
+extern uint8_t pmem_page_dirty[];
+#define pmem_page_dirty_of(p) pmem_page_dirty[(unsigned)(p) >> 12]
+
+/* host address of a RAM page in the physical memory map, NULL for other pages */
+#define NR_PMEM_MAP (1u << 20)
+extern uint8_t *pmem_map[];
+#define pmem_map_host(p) pmem_map[(unsigned)(p) >> 12]
+
 /* convert the guest physical address in the guest program to host virtual address in NEMU */
 #define guest_to_host(p) ((void *)(pmem + (unsigned)p))
 /* convert the host virtual address in NEMU to guest physical address in the guest program */
 #define host_to_guest(p) ((paddr_t)((void *)p - (void *)pmem))
 
+enum { MEM_READ, MEM_WRITE, MEM_EXEC };
+
 uint32_t vaddr_read(vaddr_t, int);
+uint32_t vaddr_ifetch(vaddr_t, int);
 uint32_t paddr_read(paddr_t, int);
 void vaddr_write(vaddr_t, int, uint32_t);
 void paddr_write(paddr_t, int, uint32_t);
 
+void pmem_map_mmio(paddr_t, int);
+void pmem_touch(paddr_t, int);
+
+paddr_t page_translate(vaddr_t, int);
+
+/* Software TLB, direct-mapped by virtual page number. For each type of
+ * access, an entry records the virtual page if the access is allowed
+ * without walking the page table again. Only RAM pages are cached,
+ * so a hit is served with the host pointer directly.
+ */
+#define NR_TLB 1024
+
+typedef struct {
+  vaddr_t tag[3];   // indexed by MEM_READ, MEM_WRITE, MEM_EXEC
+  paddr_t ppage;
+  uint8_t *host;
+  uint32_t *pgen;
+} TLBEntry;
+
+extern TLBEntry tlb[];
+#define tlb_entry(addr) (&tlb[((addr) >> 12) % NR_TLB])
+
+void tlb_flush(void);
+
+#if defined(DIFF_TEST) || defined(DIFF_REF)
+/* For batched differential testing, stores of the guest are summed into
+ * `mem_write_hash', which is independent of their order, and RAM writes
+ * are logged after mem_checkpoint(), so that mem_rewind() can undo them.
+ */
+#define MEM_WRITE_LOG
+extern uint64_t mem_write_hash;
+void mem_checkpoint(void);
+void mem_rewind(void);
+#endif
+
 #endif
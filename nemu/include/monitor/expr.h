@@ -3,6 +3,15 @@
 
 #include "common.h"
 
+/* An expression compiled to the bytecode of a stack machine, so that
+ * watchpoints evaluate it without parsing it again.
+ */
+typedef struct Expr Expr;
+
+Expr* expr_compile(char *);
+uint32_t expr_eval(Expr *, bool *);
+void expr_free(Expr *);
+
 uint32_t expr(char *, bool *);
 
 #endif
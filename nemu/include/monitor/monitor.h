@@ -1,7 +1,13 @@
 #ifndef __MONITOR_H__
 #define __MONITOR_H__
 
+#define ENTRY_START 0x100000
+
 enum { NEMU_STOP, NEMU_RUNNING, NEMU_END };
 extern int nemu_state;
 
+/* set when the program ends with nemu_trap, which reports eax */
+extern int nemu_trap_hit;
+extern int nemu_trap_code;
+
 #endif
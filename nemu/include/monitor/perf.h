@@ -0,0 +1,39 @@
+#ifndef __PERF_H__
+#define __PERF_H__
+
+#include "common.h"
+
+/* Counters of how NEMU itself performs, printed by `info perf' and, with
+ * --perf-json, written as JSON when the program ends. They only count,
+ * so they are always on.
+ */
+
+typedef struct {
+  uint64_t instr;         // retired instructions
+  uint64_t dcache_hit;    // instructions executed one by one, found in the decode cache
+  uint64_t dcache_miss;
+  uint64_t tlb_miss;
+  uint64_t intr;          // interrupts raised by devices
+  uint64_t wall_ns;       // host time spent in cpu_exec()
+  uint64_t cpu_ns;
+} PerfCounters;
+
+extern PerfCounters perf;
+
+/* accesses to a device map */
+typedef struct {
+  char name[16];
+  bool is_mmio;
+  uint64_t read, write;
+} PerfMap;
+
+PerfMap* perf_add_map(const char *, bool);
+uint64_t perf_map_total(bool);
+
+void init_perf(const char *);
+void perf_start(void);
+void perf_stop(void);
+void perf_print(void);
+void perf_print_mips(void);
+
+#endif
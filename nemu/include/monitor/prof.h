@@ -0,0 +1,17 @@
+#ifndef __PROF_H__
+#define __PROF_H__
+
+#include "common.h"
+
+/* Guest profiler. With --prof, every instruction is counted by its eip,
+ * and calls are followed to count the instructions of each call stack.
+ * With --prof=N, eip is sampled once every N instructions instead, which
+ * costs nothing between samples. The report is printed at exit.
+ */
+
+extern bool prof_exact;
+
+void init_prof(int, const char *);
+void prof_count(vaddr_t, uint32_t);
+
+#endif
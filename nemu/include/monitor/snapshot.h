@@ -0,0 +1,39 @@
+#ifndef __SNAPSHOT_H__
+#define __SNAPSHOT_H__
+
+#include "common.h"
+
+/* Snapshot of the whole machine. The file starts with a SnapshotHeader,
+ * followed by the registered state regions, each as a SnapshotRegion and
+ * its data, then the numbers of the saved physical pages. The contents of
+ * the pages start at `data_offset', which is page aligned, so that they
+ * can be mapped into memory directly when the snapshot is loaded.
+ *
+ * Only pages written since boot are saved, other pages are zero.
+ */
+
+#define SNAPSHOT_MAGIC 0x50414e53  // "SNAP"
+#define SNAPSHOT_VERSION 1
+
+typedef struct {
+  uint32_t magic;
+  uint32_t version;
+  uint32_t pmem_size;
+  uint32_t nr_region;
+  uint32_t nr_page;
+  uint32_t data_offset;
+} SnapshotHeader;
+
+#define SNAPSHOT_NAME_LEN 16
+
+typedef struct {
+  char name[SNAPSHOT_NAME_LEN];
+  uint32_t size;
+} SnapshotRegion;
+
+void add_snapshot_region(const char *, void *, uint32_t);
+
+bool snapshot_save(const char *);
+bool snapshot_load(const char *);
+
+#endif
@@ -0,0 +1,14 @@
+#ifndef __SYMBOL_H__
+#define __SYMBOL_H__
+
+#include "common.h"
+
+/* Symbols of the guest program, from its ELF file, or from the output of
+ * `objdump -d' if only that is at hand.
+ */
+bool load_elf_symbols(const char *);
+bool load_objdump_symbols(const char *);
+bool symbol_lookup(const char *, vaddr_t *);
+const char* symbol_find(vaddr_t, vaddr_t *);
+
+#endif
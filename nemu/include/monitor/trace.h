@@ -0,0 +1,32 @@
+#ifndef __TRACE_H__
+#define __TRACE_H__
+
+#include <stdint.h>
+
+/* Binary instruction trace. The file starts with a TraceHeader and is
+ * followed by one TraceRecord per executed instruction. It is turned into
+ * text by tools/nemu-trace.
+ */
+
+#define TRACE_MAGIC 0x4352544e  // "NTRC"
+#define TRACE_VERSION 1
+
+#define TRACE_INSTR_MAX 15
+
+typedef struct {
+  uint32_t magic;
+  uint32_t version;
+} TraceHeader;
+
+typedef struct {
+  uint32_t eip;
+  uint8_t len;
+  uint8_t instr[TRACE_INSTR_MAX];
+} TraceRecord;
+
+extern int trace_enabled;
+
+void init_trace(const char *);
+void trace_write(uint32_t, int, const uint8_t *);
+
+#endif
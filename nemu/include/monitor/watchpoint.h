@@ -2,14 +2,37 @@
 #define __WATCHPOINT_H__
 
 #include "common.h"
+#include "monitor/expr.h"
+
+#define WP_EXPR_LEN 64
 
 typedef struct watchpoint {
   int NO;
   struct watchpoint *next;
 
-  /* TODO: Add more members if necessary */
+  char expr[WP_EXPR_LEN];
+  /* memory watchpoints watch [addr, addr + 4) in the virtual address space,
+   * other watchpoints evaluate `code', compiled from `expr', after every instruction
+   */
+  bool is_mem;
+  vaddr_t addr;
+  Expr *code;
+  uint32_t old_val;
+} WP;
+
+/* Memory watchpoints are checked by the memory fast path: the TLB never
+ * caches write permission of a watched page, so only writes to the
+ * watched pages call watch_write().
+ */
+extern int nr_watch_mem;
+extern int nr_watch_expr;
 
+bool watch_page(vaddr_t);
+void watch_write(vaddr_t, int, uint32_t);
+bool check_watch_expr(void);
 
-} WP;
+int set_watchpoint(char *);
+bool delete_watchpoint(int);
+void list_watchpoints(void);
 
 #endif
@@ -0,0 +1,86 @@
+#include "cpu/decode-cache.h"
+#include "memory/mmu.h"
+
+/* A direct-mapped cache of decoded instructions indexed by eip.
+ * A hit skips instruction fetch, opcode table walking and the decode
+ * helpers. Only the operand addresses and values are recomputed, since
+ * they depend on the current machine state.
+ */
+
+#define NR_DCACHE 4096
+
+static DCacheEntry dcache[NR_DCACHE];
+
+/* the decoding of the instruction being executed, captured right before
+ * its execution helper is called */
+static DCacheEntry staged;
+
+/* Entries are looked up by eip, so they are flushed when the virtual
+ * address space changes.
+ */
+void dcache_flush() {
+  int i;
+  for (i = 0; i < NR_DCACHE; i ++) {
+    dcache[i].eip = -1;
+  }
+  staged.execute = NULL;
+}
+
+void init_dcache() {
+  dcache_flush();
+}
+
+void dcache_stage(EHelper execute) {
+  staged.execute = execute;
+  staged.info = decoding;
+}
+
+/* The generation of the code page of `eip', read before the instruction
+ * runs, since it may rewrite its own bytes.
+ */
+uint32_t dcache_gen(vaddr_t eip) {
+  paddr_t paddr = page_translate(eip, MEM_EXEC);
+  return (pmem_map_host(paddr) != NULL ? pmem_page_gen_of(paddr) : 0);
+}
+
+void dcache_fill(vaddr_t eip, vaddr_t seq_eip, uint32_t gen) {
+  if (staged.execute == NULL) { return; }
+
+  /* do not cache instructions crossing a page boundary */
+  if (((seq_eip - 1) ^ eip) & ~PAGE_MASK) {
+    staged.execute = NULL;
+    return;
+  }
+
+  /* nor instructions outside RAM */
+  paddr_t paddr = page_translate(eip, MEM_EXEC);
+  if (pmem_map_host(paddr) == NULL) {
+    staged.execute = NULL;
+    return;
+  }
+
+  DCacheEntry *e = &dcache[eip % NR_DCACHE];
+  *e = staged;
+  e->eip = eip;
+  e->pgen = &pmem_page_gen_of(paddr);
+  e->gen = gen;
+  e->len = seq_eip - eip;
+  staged.execute = NULL;
+}
+
+DCacheEntry* dcache_lookup(vaddr_t eip) {
+  DCacheEntry *e = &dcache[eip % NR_DCACHE];
+  if (e->eip != eip || e->gen != *e->pgen) {
+    return NULL;
+  }
+  return e;
+}
+
+/* make `decoding' look as if the instruction had just been decoded */
+void dcache_load(DCacheEntry *e) {
+  decoding = e->info;
+  decoding.seq_eip = e->eip + e->len;
+  operand_reload(id_src);
+  operand_reload(id_dest);
+  operand_reload(id_src2);
+}
@@ -17,9 +17,6 @@ static inline make_DopHelper(I) {
   op->imm = instr_fetch(eip, op->width);
   rtl_li(&op->val, op->imm);
 
-#ifdef DEBUG
-  snprintf(op->str, OP_STR_SIZE, "$0x%x", op->imm);
-#endif
 }
 
 /* I386 manual does not contain this abbreviation, but it is different from
@@ -42,9 +39,6 @@ static inline make_DopHelper(SI) {
 
   rtl_li(&op->val, op->simm);
 
-#ifdef DEBUG
-  snprintf(op->str, OP_STR_SIZE, "$0x%x", op->simm);
-#endif
 }
 
 /* I386 manual does not contain this abbreviation.
@@ -55,12 +49,9 @@ static inline make_DopHelper(a) {
   op->type = OP_TYPE_REG;
   op->reg = R_EAX;
   if (load_val) {
-    rtl_lr(&op->val, R_EAX, op->width);
+    operand_load_reg(op, op->width);
   }
 
-#ifdef DEBUG
-  snprintf(op->str, OP_STR_SIZE, "%%%s", reg_name(R_EAX, op->width));
-#endif
 }
 
 /* This helper function is use to decode register encoded in the opcode. */
@@ -71,12 +62,9 @@ static inline make_DopHelper(r) {
   op->type = OP_TYPE_REG;
   op->reg = decoding.opcode & 0x7;
   if (load_val) {
-    rtl_lr(&op->val, op->reg, op->width);
+    operand_load_reg(op, op->width);
   }
 
-#ifdef DEBUG
-  snprintf(op->str, OP_STR_SIZE, "%%%s", reg_name(op->reg, op->width));
-#endif
 }
 
 /* I386 manual does not contain this abbreviation.
@@ -97,13 +85,13 @@ static inline void decode_op_rm(vaddr_t *eip, Operand *rm, bool load_rm_val, Ope
 static inline make_DopHelper(O) {
   op->type = OP_TYPE_MEM;
   op->addr = instr_fetch(eip, 4);
+  op->mem.base = op->mem.index = -1;
+  op->mem.scale = 0;
+  op->mem.disp = op->addr;
   if (load_val) {
-    rtl_lm(&op->val, &op->addr, op->width);
+    operand_load_mem(op, op->width);
   }
 
-#ifdef DEBUG
-  snprintf(op->str, OP_STR_SIZE, "0x%x", op->addr);
-#endif
 }
 
 /* Eb <- Gb
@@ -221,19 +209,13 @@ make_DHelper(gp2_1_E) {
   id_src->type = OP_TYPE_IMM;
   id_src->imm = 1;
   rtl_li(&id_src->val, 1);
-#ifdef DEBUG
-  sprintf(id_src->str, "$1");
-#endif
 }
 
 make_DHelper(gp2_cl2E) {
   decode_op_rm(eip, id_dest, true, NULL, false);
   id_src->type = OP_TYPE_REG;
   id_src->reg = R_CL;
-  rtl_lr_b(&id_src->val, R_CL);
-#ifdef DEBUG
-  sprintf(id_src->str, "%%cl");
-#endif
+  operand_load_reg(id_src, 1);
 }
 
 make_DHelper(gp2_Ib2E) {
@@ -279,11 +261,7 @@ make_DHelper(in_I2a) {
 make_DHelper(in_dx2a) {
   id_src->type = OP_TYPE_REG;
   id_src->reg = R_DX;
-  rtl_lr_w(&id_src->val, R_DX);
-#ifdef DEBUG
-  sprintf(id_src->str, "(%%dx)");
-#endif
-
+  operand_load_reg(id_src, 2);
   decode_op_a(eip, id_dest, false);
 }
 
@@ -298,14 +276,54 @@ make_DHelper(out_a2dx) {
 
   id_dest->type = OP_TYPE_REG;
   id_dest->reg = R_DX;
-  rtl_lr_w(&id_dest->val, R_DX);
-#ifdef DEBUG
-  sprintf(id_dest->str, "(%%dx)");
-#endif
+  operand_load_reg(id_dest, 2);
 }
 
 void operand_write(Operand *op, rtlreg_t* src) {
-  if (op->type == OP_TYPE_REG) { rtl_sr(op->reg, op->width, src); }
-  else if (op->type == OP_TYPE_MEM) { rtl_sm(&op->addr, op->width, src); }
-  else { assert(0); }
+  operand_write_width(op, src, op->width);
+}
+
+/* Render an operand in AT&T syntax from its decoding. This is deferred
+ * until the assembly text is really needed, see print_asm(). The result
+ * stays valid until operand_str() is called three more times.
+ */
+const char* operand_str(Operand *op) {
+  static char buf[3][OP_STR_SIZE];
+  static int i = 0;
+  char *str = buf[i];
+  i = (i + 1) % 3;
+
+  switch (op->type) {
+    case OP_TYPE_REG:
+      snprintf(str, OP_STR_SIZE, "%%%s",
+          reg_name(op->reg, op->load != OP_LOAD_NONE ? op->load_width : op->width));
+      break;
+    case OP_TYPE_IMM:
+      snprintf(str, OP_STR_SIZE, "$0x%x", op->imm);
+      break;
+    case OP_TYPE_MEM: {
+      int32_t disp = op->mem.disp;
+      char *p = str;
+      if (op->mem.base == -1 && op->mem.index == -1) {
+        /* absolute address */
+        sprintf(p, "0x%x", disp);
+      }
+      else {
+        if (disp != 0) {
+          p += sprintf(p, "%s%#x", (disp < 0 ? "-" : ""), (disp < 0 ? -disp : disp));
+        }
+        p += sprintf(p, "(");
+        if (op->mem.base != -1) {
+          p += sprintf(p, "%%%s", reg_name(op->mem.base, 4));
+        }
+        if (op->mem.index != -1) {
+          p += sprintf(p, ",%%%s,%d", reg_name(op->mem.index, 4), 1 << op->mem.scale);
+        }
+        sprintf(p, ")");
+      }
+      break;
+    }
+    default: str[0] = '\0';
+  }
+  return str;
 }
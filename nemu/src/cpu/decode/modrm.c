@@ -45,35 +45,10 @@ void load_addr(vaddr_t *eip, ModR_M *m, Operand *rm) {
     rtl_add(&rm->addr, &rm->addr, &t0);
   }
 
-#ifdef DEBUG
-  char disp_buf[16];
-  char base_buf[8];
-  char index_buf[8];
-
-  if (disp_size != 0) {
-    /* has disp */
-    sprintf(disp_buf, "%s%#x", (disp < 0 ? "-" : ""), (disp < 0 ? -disp : disp));
-  }
-  else { disp_buf[0] = '\0'; }
-
-  if (base_reg == -1) { base_buf[0] = '\0'; }
-  else { 
-    sprintf(base_buf, "%%%s", reg_name(base_reg, 4));
-  }
-
-  if (index_reg == -1) { index_buf[0] = '\0'; }
-  else { 
-    sprintf(index_buf, ",%%%s,%d", reg_name(index_reg, 4), 1 << scale);
-  }
-
-  if (base_reg == -1 && index_reg == -1) {
-    sprintf(rm->str, "%s", disp_buf);
-  }
-  else {
-    sprintf(rm->str, "%s(%s%s)", disp_buf, base_buf, index_buf);
-  }
-#endif
-
+  rm->mem.base = base_reg;
+  rm->mem.index = index_reg;
+  rm->mem.scale = scale;
+  rm->mem.disp = disp;
   rm->type = OP_TYPE_MEM;
 }
 
@@ -85,29 +60,21 @@ void read_ModR_M(vaddr_t *eip, Operand *rm, bool load_rm_val, Operand *reg, bool
     reg->type = OP_TYPE_REG;
     reg->reg = m.reg;
     if (load_reg_val) {
-      rtl_lr(&reg->val, reg->reg, reg->width);
+      operand_load_reg(reg, reg->width);
     }
-
-#ifdef DEBUG
-    snprintf(reg->str, OP_STR_SIZE, "%%%s", reg_name(reg->reg, reg->width));
-#endif
   }
 
   if (m.mod == 3) {
     rm->type = OP_TYPE_REG;
     rm->reg = m.R_M;
     if (load_rm_val) {
-      rtl_lr(&rm->val, m.R_M, rm->width);
+      operand_load_reg(rm, rm->width);
     }
-
-#ifdef DEBUG
-    sprintf(rm->str, "%%%s", reg_name(m.R_M, rm->width));
-#endif
   }
   else {
     load_addr(eip, &m, rm);
     if (load_rm_val) {
-      rtl_lm(&rm->val, &rm->addr, rm->width);
+      operand_load_mem(rm, rm->width);
     }
   }
 }
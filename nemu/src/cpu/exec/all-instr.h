@@ -1,8 +1,30 @@
 #include "cpu/exec.h"
 
-make_EHelper(mov);
+declare_EHelperW(mov);
+
+declare_EHelperW(add);
+declare_EHelperW(sub);
+declare_EHelperW(cmp);
+declare_EHelperW(and);
+declare_EHelperW(or);
+declare_EHelperW(xor);
+declare_EHelperW(test);
 
 make_EHelper(operand_size);
 
 make_EHelper(inv);
 make_EHelper(nemu_trap);
+
+make_EHelper(jmp);
+make_EHelper(jcc);
+make_EHelper(jmp_rm);
+make_EHelper(call);
+make_EHelper(call_rm);
+make_EHelper(ret);
+
+make_EHelper(mov_r2cr);
+make_EHelper(invlpg);
+make_EHelper(int);
+make_EHelper(iret);
+make_EHelper(in);
+make_EHelper(out);
@@ -1,37 +1,50 @@
 #include "cpu/exec.h"
 
-make_EHelper(add) {
-  TODO();
+make_EHelperW(add) {
+  rtl_add(&t2, &id_dest->val, &id_src->val);
+  operand_write_width(id_dest, &t2, width);
+  rtl_update_eflags_lazy(LAZY_CC_ADD, &id_dest->val, &id_src->val, &t2, width);
 
   print_asm_template2(add);
 }
 
-make_EHelper(sub) {
-  TODO();
+make_EHelperW(sub) {
+  rtl_sub(&t2, &id_dest->val, &id_src->val);
+  operand_write_width(id_dest, &t2, width);
+  rtl_update_eflags_lazy(LAZY_CC_SUB, &id_dest->val, &id_src->val, &t2, width);
 
   print_asm_template2(sub);
 }
 
-make_EHelper(cmp) {
-  TODO();
+make_EHelperW(cmp) {
+  rtl_sub(&t2, &id_dest->val, &id_src->val);
+  rtl_update_eflags_lazy(LAZY_CC_SUB, &id_dest->val, &id_src->val, &t2, width);
 
   print_asm_template2(cmp);
 }
 
-make_EHelper(inc) {
-  TODO();
+make_EHelperW(inc) {
+  rtl_li(&t1, 1);
+  rtl_add(&t2, &id_dest->val, &t1);
+  operand_write_width(id_dest, &t2, width);
+  rtl_update_eflags_lazy(LAZY_CC_INC, &id_dest->val, &t1, &t2, width);
 
   print_asm_template1(inc);
 }
 
-make_EHelper(dec) {
-  TODO();
+make_EHelperW(dec) {
+  rtl_li(&t1, 1);
+  rtl_sub(&t2, &id_dest->val, &t1);
+  operand_write_width(id_dest, &t2, width);
+  rtl_update_eflags_lazy(LAZY_CC_DEC, &id_dest->val, &t1, &t2, width);
 
   print_asm_template1(dec);
 }
 
-make_EHelper(neg) {
-  TODO();
+make_EHelperW(neg) {
+  rtl_sub(&t2, &tzero, &id_dest->val);
+  operand_write_width(id_dest, &t2, width);
+  rtl_update_eflags_lazy(LAZY_CC_SUB, &tzero, &id_dest->val, &t2, width);
 
   print_asm_template1(neg);
 }
@@ -1,29 +1,99 @@
 #include "cpu/rtl.h"
 
+enum {
+  CC_O, CC_NO, CC_B,  CC_NB,
+  CC_E, CC_NE, CC_BE, CC_NBE,
+  CC_S, CC_NS, CC_P,  CC_NP,
+  CC_L, CC_NL, CC_LE, CC_NLE
+};
+
+#define cc_mask(width) (~0u >> ((4 - (width)) << 3))
+#define cc_msb(x, width) (((x) >> (((width) << 3) - 1)) & 0x1)
+
+/* Compute the flags affected by the pending operation. */
+void eflags_materialize() {
+  if (cpu.cc.op == LAZY_CC_NONE) { return; }
+
+  int width = cpu.cc.width;
+  uint32_t src1 = cpu.cc.src1 & cc_mask(width);
+  uint32_t src2 = cpu.cc.src2 & cc_mask(width);
+  uint32_t res = cpu.cc.res & cc_mask(width);
+
+  cpu.eflags.ZF = (res == 0);
+  cpu.eflags.SF = cc_msb(res, width);
+
+  switch (cpu.cc.op) {
+    case LAZY_CC_ADD:
+      cpu.eflags.CF = (res < src1);
+      // fall through
+    case LAZY_CC_INC:
+      cpu.eflags.OF = cc_msb(~(src1 ^ src2) & (src1 ^ res), width);
+      break;
+    case LAZY_CC_SUB:
+      cpu.eflags.CF = (src1 < src2);
+      // fall through
+    case LAZY_CC_DEC:
+      cpu.eflags.OF = cc_msb((src1 ^ src2) & (src1 ^ res), width);
+      break;
+    case LAZY_CC_LOGIC:
+      cpu.eflags.CF = cpu.eflags.OF = 0;
+      break;
+    case LAZY_CC_ZFSF: break;
+    default: panic("invalid lazy flags operation %d", cpu.cc.op);
+  }
+
+  cpu.cc.op = LAZY_CC_NONE;
+}
+
+/* Evaluate the condition code from the pending operation without
+ * materializing the flags. Return false if it is not a simple case.
+ */
+static inline bool lazy_cc(rtlreg_t* dest, int cc) {
+  int width = cpu.cc.width;
+  uint32_t res = cpu.cc.res & cc_mask(width);
+
+  switch (cc) {
+    case CC_E: *dest = (res == 0); return true;
+    case CC_S: *dest = cc_msb(res, width); return true;
+    default: break;
+  }
+
+  if (cpu.cc.op == LAZY_CC_SUB) {
+    /* the operands are aligned to the left, so that they can be compared as 32-bit values */
+    int shift = (4 - width) << 3;
+    uint32_t src1 = cpu.cc.src1 << shift;
+    uint32_t src2 = cpu.cc.src2 << shift;
+    switch (cc) {
+      case CC_B:  *dest = (src1 < src2); return true;
+      case CC_BE: *dest = (src1 <= src2); return true;
+      case CC_L:  *dest = ((int32_t)src1 < (int32_t)src2); return true;
+      case CC_LE: *dest = ((int32_t)src1 <= (int32_t)src2); return true;
+      default: break;
+    }
+  }
+
+  return false;
+}
+
 /* Condition Code */
 
 void rtl_setcc(rtlreg_t* dest, uint8_t subcode) {
   bool invert = subcode & 0x1;
-  enum {
-    CC_O, CC_NO, CC_B,  CC_NB,
-    CC_E, CC_NE, CC_BE, CC_NBE,
-    CC_S, CC_NS, CC_P,  CC_NP,
-    CC_L, CC_NL, CC_LE, CC_NLE
-  };
-
-  // TODO: Query EFLAGS to determine whether the condition code is satisfied.
+
   // dest <- ( cc is satisfied ? 1 : 0)
-  switch (subcode & 0xe) {
-    case CC_O:
-    case CC_B:
-    case CC_E:
-    case CC_BE:
-    case CC_S:
-    case CC_L:
-    case CC_LE:
-      TODO();
-    default: panic("should not reach here");
-    case CC_P: panic("n86 does not have PF");
+  if (cpu.cc.op == LAZY_CC_NONE || !lazy_cc(dest, subcode & 0xe)) {
+    eflags_materialize();
+    switch (subcode & 0xe) {
+      case CC_O: *dest = cpu.eflags.OF; break;
+      case CC_B: *dest = cpu.eflags.CF; break;
+      case CC_E: *dest = cpu.eflags.ZF; break;
+      case CC_BE: *dest = cpu.eflags.CF | cpu.eflags.ZF; break;
+      case CC_S: *dest = cpu.eflags.SF; break;
+      case CC_L: *dest = cpu.eflags.SF ^ cpu.eflags.OF; break;
+      case CC_LE: *dest = cpu.eflags.ZF | (cpu.eflags.SF ^ cpu.eflags.OF); break;
+      default: panic("should not reach here");
+      case CC_P: panic("n86 does not have PF");
+    }
   }
 
   if (invert) {
@@ -20,7 +20,7 @@ make_EHelper(jmp_rm) {
   decoding.jmp_eip = id_dest->val;
   decoding.is_jmp = 1;
 
-  print_asm("jmp *%s", id_dest->str);
+  print_asm("jmp *%s", operand_str(id_dest));
 }
 
 make_EHelper(call) {
@@ -39,5 +39,5 @@ make_EHelper(ret) {
 make_EHelper(call_rm) {
   TODO();
 
-  print_asm("call *%s", id_dest->str);
+  print_asm("call *%s", operand_str(id_dest));
 }
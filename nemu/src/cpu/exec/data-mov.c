@@ -1,7 +1,7 @@
 #include "cpu/exec.h"
 
-make_EHelper(mov) {
-  operand_write(id_dest, &id_src->val);
+make_EHelperW(mov) {
+  operand_write_width(id_dest, &id_src->val, width);
   print_asm_template2(mov);
 }
 
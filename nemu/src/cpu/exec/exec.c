@@ -1,10 +1,14 @@
 #include "cpu/exec.h"
+#include "cpu/decode-cache.h"
+#include "monitor/trace.h"
+#include "monitor/perf.h"
 #include "all-instr.h"
 
 typedef struct {
   DHelper decode;
   EHelper execute;
   int width;
+  EHelper execute_w[3];  // instances of a width-specialized helper, indexed by width >> 1
 } opcode_entry;
 
 #define IDEXW(id, ex, w)   {concat(decode_, id), concat(exec_, ex), w}
@@ -13,11 +17,22 @@ typedef struct {
 #define EX(ex)             EXW(ex, 0)
 #define EMPTY              EX(inv)
 
+/* the same entries for helpers defined by make_EHelperW() */
+#define EX_INSTANCES(ex)   {concat3(exec_, ex, _b), concat3(exec_, ex, _w), concat3(exec_, ex, _l)}
+#define IDEXWS(id, ex, w)  {concat(decode_, id), concat(exec_, ex), w, EX_INSTANCES(ex)}
+#define IDEXS(id, ex)      IDEXWS(id, ex, 0)
+#define EXWS(ex, w)        {NULL, concat(exec_, ex), w, EX_INSTANCES(ex)}
+#define EXS(ex)            EXWS(ex, 0)
+
+static inline void set_width_resolved(int width) {
+  decoding.src.width = decoding.dest.width = decoding.src2.width = width;
+}
+
 static inline void set_width(int width) {
   if (width == 0) {
     width = decoding.is_operand_size_16 ? 2 : 4;
   }
-  decoding.src.width = decoding.dest.width = decoding.src2.width = width;
+  set_width_resolved(width);
 }
 
 /* Instruction Decode and EXecute */
@@ -25,6 +40,7 @@ static inline void idex(vaddr_t *eip, opcode_entry *e) {
   /* eip is pointing to the byte next to opcode */
   if (e->decode)
     e->decode(eip);
+  dcache_stage(e->execute);
   e->execute(eip);
 }
 
@@ -67,7 +83,7 @@ make_group(gp5,
   /* 0x0f 0x01*/
 make_group(gp7,
     EMPTY, EMPTY, EMPTY, EMPTY,
-    EMPTY, EMPTY, EMPTY, EMPTY)
+    EMPTY, EMPTY, EMPTY, EX(invlpg))
 
 /* TODO: Add more instructions!!! */
 
@@ -106,22 +122,22 @@ opcode_entry opcode_table [512] = {
   /* 0x7c */	EMPTY, EMPTY, EMPTY, EMPTY,
   /* 0x80 */	IDEXW(I2E, gp1, 1), IDEX(I2E, gp1), EMPTY, IDEX(SI2E, gp1),
   /* 0x84 */	EMPTY, EMPTY, EMPTY, EMPTY,
-  /* 0x88 */	IDEXW(mov_G2E, mov, 1), IDEX(mov_G2E, mov), IDEXW(mov_E2G, mov, 1), IDEX(mov_E2G, mov),
+  /* 0x88 */	IDEXWS(mov_G2E, mov, 1), IDEXS(mov_G2E, mov), IDEXWS(mov_E2G, mov, 1), IDEXS(mov_E2G, mov),
   /* 0x8c */	EMPTY, EMPTY, EMPTY, EMPTY,
   /* 0x90 */	EMPTY, EMPTY, EMPTY, EMPTY,
   /* 0x94 */	EMPTY, EMPTY, EMPTY, EMPTY,
   /* 0x98 */	EMPTY, EMPTY, EMPTY, EMPTY,
   /* 0x9c */	EMPTY, EMPTY, EMPTY, EMPTY,
-  /* 0xa0 */	IDEXW(O2a, mov, 1), IDEX(O2a, mov), IDEXW(a2O, mov, 1), IDEX(a2O, mov),
+  /* 0xa0 */	IDEXWS(O2a, mov, 1), IDEXS(O2a, mov), IDEXWS(a2O, mov, 1), IDEXS(a2O, mov),
   /* 0xa4 */	EMPTY, EMPTY, EMPTY, EMPTY,
   /* 0xa8 */	EMPTY, EMPTY, EMPTY, EMPTY,
   /* 0xac */	EMPTY, EMPTY, EMPTY, EMPTY,
-  /* 0xb0 */	IDEXW(mov_I2r, mov, 1), IDEXW(mov_I2r, mov, 1), IDEXW(mov_I2r, mov, 1), IDEXW(mov_I2r, mov, 1),
-  /* 0xb4 */	IDEXW(mov_I2r, mov, 1), IDEXW(mov_I2r, mov, 1), IDEXW(mov_I2r, mov, 1), IDEXW(mov_I2r, mov, 1),
-  /* 0xb8 */	IDEX(mov_I2r, mov), IDEX(mov_I2r, mov), IDEX(mov_I2r, mov), IDEX(mov_I2r, mov),
-  /* 0xbc */	IDEX(mov_I2r, mov), IDEX(mov_I2r, mov), IDEX(mov_I2r, mov), IDEX(mov_I2r, mov),
+  /* 0xb0 */	IDEXWS(mov_I2r, mov, 1), IDEXWS(mov_I2r, mov, 1), IDEXWS(mov_I2r, mov, 1), IDEXWS(mov_I2r, mov, 1),
+  /* 0xb4 */	IDEXWS(mov_I2r, mov, 1), IDEXWS(mov_I2r, mov, 1), IDEXWS(mov_I2r, mov, 1), IDEXWS(mov_I2r, mov, 1),
+  /* 0xb8 */	IDEXS(mov_I2r, mov), IDEXS(mov_I2r, mov), IDEXS(mov_I2r, mov), IDEXS(mov_I2r, mov),
+  /* 0xbc */	IDEXS(mov_I2r, mov), IDEXS(mov_I2r, mov), IDEXS(mov_I2r, mov), IDEXS(mov_I2r, mov),
   /* 0xc0 */	IDEXW(gp2_Ib2E, gp2, 1), IDEX(gp2_Ib2E, gp2), EMPTY, EMPTY,
-  /* 0xc4 */	EMPTY, EMPTY, IDEXW(mov_I2E, mov, 1), IDEX(mov_I2E, mov),
+  /* 0xc4 */	EMPTY, EMPTY, IDEXWS(mov_I2E, mov, 1), IDEXS(mov_I2E, mov),
   /* 0xc8 */	EMPTY, EMPTY, EMPTY, EMPTY,
   /* 0xcc */	EMPTY, EMPTY, EMPTY, EMPTY,
   /* 0xd0 */	IDEXW(gp2_1_E, gp2, 1), IDEX(gp2_1_E, gp2), IDEXW(gp2_cl2E, gp2, 1), IDEX(gp2_cl2E, gp2),
@@ -219,30 +235,172 @@ make_EHelper(real) {
   idex(eip, &opcode_table[opcode]);
 }
 
-static inline void update_eip(void) {
-  cpu.eip = (decoding.is_jmp ? (decoding.is_jmp = 0, decoding.jmp_eip) : decoding.seq_eip);
+#ifdef THREADED_DISPATCH
+/* The one-byte table, the two-byte table and the items of every group are
+ * flattened into one table, which is duplicated for both operand sizes so
+ * that widths are resolved in advance. Items of a group are laid out once
+ * for each width, since a group item takes the width of its opcode. With
+ * the width known, width-specialized helpers are picked here as well.
+ * Prefixes, escapes and groups are then followed with computed goto
+ * instead of nested calls to idex().
+ */
+enum { FLAT_IDEX, FLAT_GROUP, FLAT_ESC, FLAT_PREFIX };
+
+typedef struct {
+  DHelper decode;
+  EHelper execute;
+  uint8_t kind;
+  uint8_t width;
+  uint16_t group;   // index of the first item for FLAT_GROUP
+} flat_entry;
+
+#define NR_GROUP 6
+#define flat_group(i, width) (512 + ((i) * 3 + ((width) >> 1)) * 8)
+#define NR_FLAT flat_group(NR_GROUP, 0)
+
+static const struct {
+  EHelper execute;
+  opcode_entry *table;
+} group_table [NR_GROUP] = {
+  {exec_gp1, opcode_table_gp1}, {exec_gp2, opcode_table_gp2},
+  {exec_gp3, opcode_table_gp3}, {exec_gp4, opcode_table_gp4},
+  {exec_gp5, opcode_table_gp5}, {exec_gp7, opcode_table_gp7}
+};
+
+static flat_entry flat_table [2][NR_FLAT];
+
+static void flat_fill(flat_entry *f, opcode_entry *e, int width) {
+  f->decode = e->decode;
+  f->execute = (e->execute_w[0] != NULL ? e->execute_w[width >> 1] : e->execute);
+  f->width = width;
+  f->kind = FLAT_IDEX;
+  f->group = 0;
+
+  if (e->execute == exec_2byte_esc) { f->kind = FLAT_ESC; }
+  else if (e->execute == exec_operand_size) { f->kind = FLAT_PREFIX; }
+  else {
+    int i;
+    for (i = 0; i < NR_GROUP; i ++) {
+      if (e->execute == group_table[i].execute) {
+        f->kind = FLAT_GROUP;
+        f->group = flat_group(i, width);
+      }
+    }
+  }
 }
 
-void exec_wrapper(bool print_flag) {
+void init_flat_table() {
+  static const int widths[] = {1, 2, 4};
+  int size, i, j, k;
+  for (size = 0; size < 2; size ++) {
+    for (i = 0; i < 512; i ++) {
+      int width = opcode_table[i].width;
+      flat_fill(&flat_table[size][i], &opcode_table[i], width != 0 ? width : (size ? 2 : 4));
+    }
+    for (i = 0; i < NR_GROUP; i ++) {
+      for (k = 0; k < 3; k ++) {
+        for (j = 0; j < 8; j ++) {
+          flat_fill(&flat_table[size][flat_group(i, widths[k]) + j], &group_table[i].table[j], widths[k]);
+        }
+      }
+    }
+  }
+}
+
+make_EHelper(threaded) {
+  static const void *handler[] = {
+    [FLAT_IDEX] = &&idex, [FLAT_GROUP] = &&group,
+    [FLAT_ESC] = &&esc, [FLAT_PREFIX] = &&prefix
+  };
+  flat_entry *table = flat_table[0];
+  uint32_t opcode = instr_fetch(eip, 1);
+  flat_entry *e = &table[opcode];
+  decoding.opcode = opcode;
+  goto *handler[e->kind];
+
+prefix:
+  decoding.is_operand_size_16 = true;
+  table = flat_table[1];
+  opcode = instr_fetch(eip, 1);
+  e = &table[opcode];
+  decoding.opcode = opcode;
+  goto *handler[e->kind];
+
+esc:
+  opcode = instr_fetch(eip, 1) | 0x100;
+  e = &table[opcode];
+  decoding.opcode = opcode;
+  goto *handler[e->kind];
+
+group:
+  /* the decode helper of the group fetches ModR/M, which selects the item */
+  set_width_resolved(e->width);
+  if (e->decode)
+    e->decode(eip);
+  e = &table[e->group + decoding.ext_opcode];
+  goto item;
+
+idex:
+  set_width_resolved(e->width);
+item:
+  if (e->decode)
+    e->decode(eip);
+  dcache_stage(e->execute);
+  e->execute(eip);
+  decoding.is_operand_size_16 = false;
+}
+#endif
+
 #ifdef DEBUG
-  decoding.p = decoding.asm_buf;
-  decoding.p += sprintf(decoding.p, "%8x:   ", cpu.eip);
+bool print_asm_enabled = false;
+
+/* the assembly text is wanted if it is printed or written to the text log */
+static inline void print_asm_enable(bool print_flag) {
+  print_asm_enabled = print_flag || (log_fp != NULL && !trace_enabled);
+}
+#else
+static inline void print_asm_enable(bool print_flag) { }
 #endif
 
-  decoding.seq_eip = cpu.eip;
-  exec_real(&decoding.seq_eip);
+/* The binary trace, the text log and diff-test want every instruction
+ * with its whole decoding, which blocks do not keep. Otherwise the
+ * assembly text is turned off, since blocks do not print it.
+ */
+bool exec_needs_decoding() {
+#ifdef DIFF_TEST
+  return true;
+#else
+  print_asm_enable(false);
+#ifdef DEBUG
+  if (print_asm_enabled) { return true; }
+#endif
+  return trace_enabled;
+#endif
+}
+
+static inline void exec_finish(bool print_flag) {
+  if (trace_enabled) {
+    trace_write(cpu.eip, decoding.seq_eip - cpu.eip, decoding.instr);
+  }
 
 #ifdef DEBUG
-  int instr_len = decoding.seq_eip - cpu.eip;
-  sprintf(decoding.p, "%*.s", 50 - (12 + 3 * instr_len), "");
-  char strbuf[512];
-  strcpy(strbuf, decoding.asm_buf);
-  // strcat(decoding.asm_buf, decoding.assembly);
-  strcat(strbuf, decoding.assembly);
-  strcpy(decoding.asm_buf, strbuf);
-  Log_write("%s\n", decoding.asm_buf);
-  if (print_flag) {
-    puts(decoding.asm_buf);
+  if (print_asm_enabled) {
+    char asm_buf[128];
+    char *p = asm_buf + sprintf(asm_buf, "%8x:   ", cpu.eip);
+    int instr_len = decoding.seq_eip - cpu.eip;
+    int i;
+    for (i = 0; i < instr_len && i < sizeof(decoding.instr); i ++) {
+      p += sprintf(p, "%02x ", decoding.instr[i]);
+    }
+    sprintf(p, "%*.s%s", 50 - (12 + 3 * instr_len), "", decoding.assembly);
+
+    /* with the binary trace, the text log is rendered offline by nemu-trace */
+    if (!trace_enabled) {
+      Log_write("%s\n", asm_buf);
+    }
+    if (print_flag) {
+      puts(asm_buf);
+    }
   }
 #endif
 
@@ -257,3 +415,36 @@ void exec_wrapper(bool print_flag) {
   difftest_step(eip);
 #endif
 }
+
+/* Execute an instruction whose decoding is cached. */
+static void exec_cached(DCacheEntry *e, bool print_flag) {
+  print_asm_enable(print_flag);
+  dcache_load(e);
+  e->execute(&decoding.seq_eip);
+  decoding.is_operand_size_16 = false;
+
+  exec_finish(print_flag);
+}
+
+void exec_wrapper(bool print_flag) {
+  DCacheEntry *e = dcache_lookup(cpu.eip);
+  if (e != NULL) {
+    perf.dcache_hit ++;
+    exec_cached(e, print_flag);
+    return;
+  }
+  perf.dcache_miss ++;
+  uint32_t gen = dcache_gen(cpu.eip);
+
+  print_asm_enable(print_flag);
+  decoding.src.load = decoding.dest.load = decoding.src2.load = OP_LOAD_NONE;
+  decoding.seq_eip = cpu.eip;
+#ifdef THREADED_DISPATCH
+  exec_threaded(&decoding.seq_eip);
+#else
+  exec_real(&decoding.seq_eip);
+#endif
+  dcache_fill(cpu.eip, decoding.seq_eip, gen);
+
+  exec_finish(print_flag);
+}
@@ -0,0 +1,635 @@
+#include "cpu/jit.h"
+
+/* Compile hot translation blocks. */
+bool jit_mode = false;
+
+#ifdef HAS_JIT
+
+#include "monitor/monitor.h"
+#include "all-instr.h"
+#include <stddef.h>
+#include <sys/mman.h>
+
+/* Hot translation blocks are compiled to x86-64 host code.
+ *
+ * mov and the 32-bit add, sub, cmp, and, or, xor and test are compiled
+ * inline. The guest registers live in r8-r15 across the block: they are
+ * loaded when first used, and written back to `cpu' only at the exits of
+ * the block and before calls of helpers. The flags are computed by the
+ * host instruction doing the same operation, and recorded into `cpu.cc'
+ * as rtl_update_eflags_lazy() does. A jcc ending the block branches on
+ * the host flags directly. Memory operands are accessed through the TLB,
+ * or the physical memory map without paging, with calls of vaddr_read()
+ * and vaddr_write() as the slow path. The paging mode is fixed when the
+ * block is compiled, since writing CR0 flushes all blocks.
+ *
+ * Other instructions call tb_exec_instr(), as tb_exec() does.
+ *
+ * Host registers: rbx = &cpu, ebp = the guest address of the memory
+ * operand, r8-r15 = the guest registers, rax, rcx, rdx, rsi and rdi are
+ * scratch. The code which is rarely run (slow paths and early exits) is
+ * emitted out of line into `cold_buf', and copied after the block.
+ */
+
+#define JIT_CODE_SIZE (8 * 1024 * 1024)
+/* enough for the longest code emitted for one instruction */
+#define JIT_MAX_INSTR_CODE 1024
+
+enum { RAX, RCX, RDX, RBX, RSP, RBP, RSI, RDI, R8 };
+#define GREG(r) (R8 + (r))
+
+/* host condition codes, the same as those of the guest */
+enum { CC_E = 0x4, CC_NE = 0x5, CC_P = 0xa, CC_A = 0x7 };
+
+static uint8_t *code_cache;
+static uint8_t *code_free;
+static uint8_t *p;
+
+static inline void emit8(uint8_t x) { *p ++ = x; }
+static inline void emit32(uint32_t x) { memcpy(p, &x, 4); p += 4; }
+static inline void emit64(uint64_t x) { memcpy(p, &x, 8); p += 8; }
+
+#define CPU_OFF(lvalue) ((int32_t)((uint8_t *)&(lvalue) - (uint8_t *)&cpu))
+#define GPR_OFF(r) CPU_OFF(cpu.gpr[r]._32)
+
+/* Instruction encoding. `op' is the opcode, with 0x0f in the second byte
+ * for two-byte opcodes, and `reg' is the register or the opcode extension
+ * in ModR/M. `w' selects 64-bit operands.
+ */
+
+static void emit_op(int w, uint32_t op, int reg, int index, int base) {
+  int rex = (w << 3) | ((reg & 8) >> 1) | ((index & 8) >> 2) | ((base & 8) >> 3);
+  if (rex != 0) { emit8(0x40 | rex); }
+  if (op > 0xff) { emit8(op >> 8); }
+  emit8(op);
+}
+
+/* op reg, rm */
+static void emit_rr(int w, uint32_t op, int reg, int rm) {
+  emit_op(w, op, reg, 0, rm);
+  emit8(0xc0 | ((reg & 7) << 3) | (rm & 7));
+}
+
+static void emit_disp(int mod, int32_t disp) {
+  if (mod == 1) { emit8(disp); }
+  else if (mod == 2) { emit32(disp); }
+}
+
+static int disp_mod(int base, int32_t disp) {
+  if (disp == 0 && (base & 7) != RBP) { return 0; }
+  return (disp == (int8_t)disp ? 1 : 2);
+}
+
+/* op reg, [base + disp] */
+static void emit_rm(int w, uint32_t op, int reg, int base, int32_t disp) {
+  int mod = disp_mod(base, disp);
+  emit_op(w, op, reg, 0, base);
+  emit8((mod << 6) | ((reg & 7) << 3) | (base & 7));
+  if ((base & 7) == RSP) { emit8(0x24); }
+  emit_disp(mod, disp);
+}
+
+/* op reg, [base + index << scale + disp], without base if `base' is -1 */
+static void emit_rsib(int w, uint32_t op, int reg, int base, int index, int scale, int32_t disp) {
+  if (base == -1) {
+    emit_op(w, op, reg, index, 0);
+    emit8(((reg & 7) << 3) | 0x4);
+    emit8((scale << 6) | ((index & 7) << 3) | RBP);
+    emit32(disp);
+    return;
+  }
+  int mod = disp_mod(base, disp);
+  emit_op(w, op, reg, index, base);
+  emit8((mod << 6) | ((reg & 7) << 3) | 0x4);
+  emit8((scale << 6) | ((index & 7) << 3) | (base & 7));
+  emit_disp(mod, disp);
+}
+
+/* mov r32, imm32 */
+static void emit_mov_ri(int r, uint32_t imm) {
+  emit_op(0, 0xb8 + (r & 7), 0, 0, r);
+  emit32(imm);
+}
+
+/* movabs r64, imm64 */
+static void emit_mov_ri64(int r, const void *imm) {
+  emit_op(1, 0xb8 + (r & 7), 0, 0, r);
+  emit64((uintptr_t)imm);
+}
+
+/* mov dword [rbx + off], imm32 */
+static void emit_store_cpu_imm(int32_t off, uint32_t imm) {
+  emit_rm(0, 0xc7, 0, RBX, off);
+  emit32(imm);
+}
+
+static void emit_push(int r) { emit_op(0, 0x50 + (r & 7), 0, 0, r); }
+static void emit_pop(int r) { emit_op(0, 0x58 + (r & 7), 0, 0, r); }
+
+static void emit_call(const void *fn) {
+  emit_mov_ri64(RAX, fn);
+  emit8(0xff); emit8(0xd0);
+}
+
+/* the 6 pushes and the adjustment keep rsp aligned to 16 bytes at calls */
+static const int saved_regs[] = { RBX, RBP, R8 + 4, R8 + 5, R8 + 6, R8 + 7 };
+
+static void emit_prologue() {
+  int i;
+  for (i = 0; i < 6; i ++) { emit_push(saved_regs[i]); }
+  emit_rr(1, 0x83, 5, RSP); emit8(8);       // sub rsp, 8
+  emit_mov_ri64(RBX, &cpu);
+}
+
+static void emit_epilogue() {
+  emit_rr(1, 0x83, 0, RSP); emit8(8);       // add rsp, 8
+  int i;
+  for (i = 5; i >= 0; i --) { emit_pop(saved_regs[i]); }
+  emit8(0xc3);
+}
+
+/* Out-of-line code. Jumps between it and the block are recorded, and
+ * resolved when it is copied after the block.
+ */
+#define COLD_SIZE (MAX_TB_INSTR * JIT_MAX_INSTR_CODE)
+#define MAX_FIXUP (MAX_TB_INSTR * 8)
+
+static uint8_t cold_buf[COLD_SIZE];
+static uint8_t *cold, *hot;
+static struct { uint8_t *field; uint32_t target; } hot2cold[MAX_FIXUP];
+static struct { uint32_t field; uint8_t *target; } cold2hot[MAX_FIXUP];
+static int nr_hot2cold, nr_cold2hot;
+
+static void cold_begin() { hot = p; p = cold; }
+static void cold_end() { cold = p; p = hot; }
+
+/* jcc rel32 from the block to the cold code at `target' */
+static void emit_jcc_cold(int cc, uint32_t target) {
+  assert(nr_hot2cold < MAX_FIXUP);
+  emit8(0x0f); emit8(0x80 | cc);
+  hot2cold[nr_hot2cold].field = p;
+  hot2cold[nr_hot2cold ++].target = target;
+  emit32(0);
+}
+
+/* jmp rel32 from the cold code back to the block */
+static void emit_jmp_hot(uint8_t *target) {
+  assert(nr_cold2hot < MAX_FIXUP);
+  emit8(0xe9);
+  cold2hot[nr_cold2hot].field = p - cold_buf;
+  cold2hot[nr_cold2hot ++].target = target;
+  emit32(0);
+}
+
+/* What is known about the machine state at the current point of the block. */
+static struct {
+  uint8_t loaded;   // guest registers held by their host registers
+  uint8_t dirty;    // guest registers newer than `cpu'
+  uint32_t cc_op;   // the values stored into cpu.cc.op and cpu.cc.width,
+  int cc_width;     // with cc_op = CC_UNKNOWN if they are not known
+  bool host_flags;  // the host flags are those of the operation in cpu.cc
+} js;
+
+#define CC_UNKNOWN (~0u)
+
+/* the host register of a guest register, loaded if it is not */
+static int greg(int r) {
+  if (!(js.loaded & (1 << r))) {
+    emit_rm(0, 0x8b, GREG(r), RBX, GPR_OFF(r));   // mov r32, [rbx + off]
+    js.loaded |= 1 << r;
+  }
+  return GREG(r);
+}
+
+/* the guest register is about to be written as a whole */
+static int greg_def(int r) {
+  js.loaded |= 1 << r;
+  js.dirty |= 1 << r;
+  return GREG(r);
+}
+
+static void emit_writeback(uint8_t dirty) {
+  int r;
+  for (r = 0; r < 8; r ++) {
+    if (dirty & (1 << r)) { emit_rm(0, 0x89, GREG(r), RBX, GPR_OFF(r)); }
+  }
+}
+
+/* Leave the block after `count' instructions if the host flags say `cc'.
+ * eip is left alone if `eip' is 0, i.e. set by the helper already.
+ */
+static void emit_exit_if(int cc, int count, vaddr_t eip) {
+  emit_jcc_cold(cc, cold - cold_buf);
+  cold_begin();
+  emit_writeback(js.dirty);
+  if (eip != 0) { emit_store_cpu_imm(CPU_OFF(cpu.eip), eip); }
+  emit_mov_ri(RAX, count);
+  emit8(0xe9); emit32(cold_buf - (p + 4));  // jmp to the epilogue at the start of cold_buf
+  cold_end();
+}
+
+/* Return from the block after `count' instructions. */
+static void emit_return(int count) {
+  emit_mov_ri(RAX, count);
+  emit_epilogue();
+}
+
+/* ebp <- the address of a memory operand */
+static void emit_addr(const TBOperand *r) {
+  if (r->base == -1 && r->index == -1) {
+    emit_mov_ri(RBP, r->imm);
+  }
+  else if (r->index == -1) {
+    emit_rm(0, 0x8d, RBP, greg(r->base), r->imm);
+  }
+  else {
+    int index = greg(r->index);
+    emit_rsib(0, 0x8d, RBP, (r->base == -1 ? -1 : greg(r->base)), index, r->scale, r->imm);
+  }
+}
+
+/* Look up the host address of the guest address in ebp for `type' of
+ * access of `width' bytes, jumping to the cold code at `slow' if it is
+ * not served by the fast path. Leave rcx = the host page, edx = the
+ * offset in the page, and with paging, rsi = the TLB entry, otherwise
+ * esi = the physical page number.
+ */
+static void emit_translate(int type, int width, uint32_t slow) {
+  if (cpu.cr0.paging) {
+    emit_rr(0, 0x89, RBP, RSI);                             // mov esi, ebp
+    emit_rr(0, 0xc1, 5, RSI); emit8(12);                    // shr esi, 12
+    emit_rr(0, 0x81, 4, RSI); emit32(NR_TLB - 1);           // and esi, NR_TLB - 1
+    emit_rr(0, 0x69, RSI, RSI); emit32(sizeof(TLBEntry));   // imul esi, esi, sizeof(TLBEntry)
+    emit_mov_ri64(RCX, tlb);
+    emit_rr(1, 0x01, RCX, RSI);                             // add rsi, rcx
+    emit_rr(0, 0x89, RBP, RDX);                             // mov edx, ebp
+    emit_rr(0, 0x81, 4, RDX); emit32(~PAGE_MASK);           // and edx, ~PAGE_MASK
+    emit_rm(0, 0x3b, RDX, RSI, offsetof(TLBEntry, tag) + type * sizeof(vaddr_t));
+    emit_jcc_cold(CC_NE, slow);
+    emit_rm(1, 0x8b, RCX, RSI, offsetof(TLBEntry, host));   // mov rcx, [rsi + host]
+  }
+  else {
+    emit_rr(0, 0x89, RBP, RSI);                             // mov esi, ebp
+    emit_rr(0, 0xc1, 5, RSI); emit8(12);                    // shr esi, 12
+    emit_mov_ri64(RDX, pmem_map);
+    emit_rsib(1, 0x8b, RCX, RDX, RSI, 3, 0);                // mov rcx, [rdx + rsi * 8]
+    emit_rr(1, 0x85, RCX, RCX);                             // test rcx, rcx
+    emit_jcc_cold(CC_E, slow);
+  }
+
+  emit_rr(0, 0x89, RBP, RDX);                               // mov edx, ebp
+  emit_rr(0, 0x81, 4, RDX); emit32(PAGE_MASK);              // and edx, PAGE_MASK
+  if (width > 1) {
+    emit_rr(0, 0x81, 7, RDX); emit32(PAGE_SIZE - width);    // cmp edx, PAGE_SIZE - width
+    emit_jcc_cold(CC_A, slow);
+  }
+}
+
+/* Call vaddr_read() or vaddr_write() in the cold code, saving the guest
+ * registers in caller-saved host registers, and go back to `back'.
+ */
+static void emit_slow_call(void *fn, int width, vaddr_t pc, uint8_t *back) {
+  cold_begin();
+  emit_store_cpu_imm(CPU_OFF(cpu.eip), pc);
+  int r;
+  for (r = 0; r < 4; r ++) { emit_push(GREG(r)); }
+  emit_rr(0, 0x89, RAX, RDX);                               // mov edx, eax
+  emit_rr(0, 0x89, RBP, RDI);                               // mov edi, ebp
+  emit_mov_ri(RSI, width);
+  emit_call(fn);
+  for (r = 3; r >= 0; r --) { emit_pop(GREG(r)); }
+  emit_jmp_hot(back);
+  cold_end();
+}
+
+/* eax <- `width' bytes at the guest address in ebp, zero extended */
+static void emit_load(int width, vaddr_t pc) {
+  uint32_t slow = cold - cold_buf;
+  emit_translate(MEM_READ, width, slow);
+  switch (width) {
+    case 4: emit_rsib(0, 0x8b, RAX, RCX, RDX, 0, 0); break;     // mov eax, [rcx + rdx]
+    case 2: emit_rsib(0, 0x0fb7, RAX, RCX, RDX, 0, 0); break;   // movzx eax, word [rcx + rdx]
+    case 1: emit_rsib(0, 0x0fb6, RAX, RCX, RDX, 0, 0); break;   // movzx eax, byte [rcx + rdx]
+    default: assert(0);
+  }
+  emit_slow_call(vaddr_read, width, pc, p);
+  js.host_flags = false;
+}
+
+/* `width' bytes of eax -> the guest address in ebp */
+static void emit_store(int width, vaddr_t pc) {
+  uint32_t slow = cold - cold_buf;
+  emit_translate(MEM_WRITE, width, slow);
+  switch (width) {
+    case 4: emit_rsib(0, 0x89, RAX, RCX, RDX, 0, 0); break;     // mov [rcx + rdx], eax
+    case 2: emit8(0x66); emit_rsib(0, 0x89, RAX, RCX, RDX, 0, 0); break;
+    case 1: emit_rsib(0, 0x88, RAX, RCX, RDX, 0, 0); break;
+    default: assert(0);
+  }
+
+  /* bump the generation of the page and mark it dirty */
+  if (cpu.cr0.paging) {
+    emit_rm(1, 0x8b, RDX, RSI, offsetof(TLBEntry, pgen));     // mov rdx, [rsi + pgen]
+    emit_rm(0, 0xff, 0, RDX, 0);                              // inc dword [rdx]
+    emit_rm(0, 0x8b, RSI, RSI, offsetof(TLBEntry, ppage));    // mov esi, [rsi + ppage]
+    emit_rr(0, 0xc1, 5, RSI); emit8(12);                      // shr esi, 12
+  }
+  else {
+    emit_mov_ri64(RDX, pmem_page_gen);
+    emit_rsib(0, 0xff, 0, RDX, RSI, 2, 0);                    // inc dword [rdx + rsi * 4]
+  }
+  emit_mov_ri64(RDX, pmem_page_dirty);
+  emit_rsib(0, 0xc6, 0, RDX, RSI, 0, 0); emit8(1);            // mov byte [rdx + rsi], 1
+
+  emit_slow_call(vaddr_write, width, pc, p);
+  js.host_flags = false;
+}
+
+/* A value of an operand, as read by the helper: in a host register, or
+ * the constant `imm' if `reg' is -1.
+ */
+typedef struct {
+  int reg;
+  uint32_t imm;
+} Value;
+
+static bool value_ok(const TBOperand *r) {
+  return r->recipe == TB_OP_CONST || r->recipe == TB_OP_REG_L || r->recipe == TB_OP_MEM_LOAD;
+}
+
+/* Get the value of an operand. A value loaded from memory is left in ecx,
+ * whose address should be in ebp already.
+ */
+static Value value_get(const TBOperand *r, vaddr_t pc) {
+  Value v = { .reg = -1, .imm = r->val };
+  if (r->recipe == TB_OP_REG_L) {
+    v.reg = greg(r->imm);
+  }
+  else if (r->recipe == TB_OP_MEM_LOAD) {
+    emit_load(r->load_width, pc);
+    emit_rr(0, 0x89, RAX, RCX);             // mov ecx, eax
+    v.reg = RCX;
+  }
+  return v;
+}
+
+/* mov reg, value */
+static void emit_mov_value(int reg, Value v) {
+  if (v.reg == -1) { emit_mov_ri(reg, v.imm); }
+  else if (v.reg != reg) { emit_rr(0, 0x89, v.reg, reg); }
+}
+
+/* mov dword [rbx + off], value */
+static void emit_store_cpu_value(int32_t off, Value v) {
+  if (v.reg == -1) { emit_store_cpu_imm(off, v.imm); }
+  else { emit_rm(0, 0x89, v.reg, RBX, off); }
+}
+
+/* Inline helpers, with the operation of the host computing the same result
+ * into eax, which is also recorded into cpu.cc.res for cmp and test.
+ */
+static const struct {
+  EHelper execute, execute_l;
+  uint8_t op_rr;      // op r/m32, r32
+  uint8_t ext;        // extension in ModR/M of op r/m32, imm32
+  uint32_t cc_op;
+  bool write;         // the result is written to the destination
+} alu_table[] = {
+  { exec_add,  exec_add_l,  0x01, 0, LAZY_CC_ADD,   true  },
+  { exec_sub,  exec_sub_l,  0x29, 5, LAZY_CC_SUB,   true  },
+  { exec_cmp,  exec_cmp_l,  0x29, 5, LAZY_CC_SUB,   false },
+  { exec_and,  exec_and_l,  0x21, 4, LAZY_CC_LOGIC, true  },
+  { exec_or,   exec_or_l,   0x09, 1, LAZY_CC_LOGIC, true  },
+  { exec_xor,  exec_xor_l,  0x31, 6, LAZY_CC_LOGIC, true  },
+  { exec_test, exec_test_l, 0x21, 4, LAZY_CC_LOGIC, false },
+};
+
+#define NR_ALU (sizeof(alu_table) / sizeof(alu_table[0]))
+
+/* the helper is `execute' or its 32-bit instance for the instruction */
+static inline bool is_helper_l(const TBInstr *in, EHelper execute, EHelper execute_l) {
+  return in->execute == execute_l || (in->execute == execute && in->dest.width == 4);
+}
+
+static bool is_mem(const TBOperand *r) {
+  return r->recipe == TB_OP_MEM || r->recipe == TB_OP_MEM_LOAD;
+}
+
+/* the destination can be written as operand_write_width() does */
+static bool dest_ok(const TBOperand *r) {
+  return r->type == OP_TYPE_REG || r->type == OP_TYPE_MEM;
+}
+
+/* Record the flags into cpu.cc, see rtl_update_eflags_lazy(). */
+static void emit_cc(uint32_t op, Value src1, Value src2) {
+  if (js.cc_op != op) { emit_store_cpu_imm(CPU_OFF(cpu.cc.op), op); js.cc_op = op; }
+  if (js.cc_width != 4) { emit_store_cpu_imm(CPU_OFF(cpu.cc.width), 4); js.cc_width = 4; }
+  emit_store_cpu_value(CPU_OFF(cpu.cc.src1), src1);
+  emit_store_cpu_value(CPU_OFF(cpu.cc.src2), src2);
+  emit_rm(0, 0x89, RAX, RBX, CPU_OFF(cpu.cc.res));
+}
+
+/* Compile mov inline. Return false if it is not supported. */
+static bool emit_mov(const TBInstr *in, vaddr_t pc) {
+  const TBOperand *src = &in->src, *dest = &in->dest;
+  if (!dest_ok(dest) || !value_ok(src) || (is_mem(src) && is_mem(dest))) { return false; }
+
+  if (is_mem(src)) { emit_addr(src); }
+  Value v = value_get(src, pc);
+  if (dest->type == OP_TYPE_REG) {
+    emit_mov_value(greg_def(dest->imm), v);
+  }
+  else {
+    emit_mov_value(RAX, v);
+    emit_addr(dest);
+    emit_store(4, pc);
+  }
+  return true;
+}
+
+/* Compile an instruction of alu_table inline. */
+static bool emit_alu(const TBInstr *in, int k, vaddr_t pc) {
+  const TBOperand *src = &in->src, *dest = &in->dest;
+  if (!dest_ok(dest) || !value_ok(src) || !value_ok(dest) || (is_mem(src) && is_mem(dest))) {
+    return false;
+  }
+
+  if (is_mem(src)) { emit_addr(src); }
+  if (is_mem(dest)) { emit_addr(dest); }
+  Value a = value_get(dest, pc);
+  Value b = value_get(src, pc);
+
+  emit_mov_value(RAX, a);
+  if (b.reg == -1) { emit_rr(0, 0x81, alu_table[k].ext, RAX); emit32(b.imm); }
+  else { emit_rr(0, alu_table[k].op_rr, b.reg, RAX); }
+  emit_cc(alu_table[k].cc_op, a, b);
+  js.host_flags = true;
+
+  if (alu_table[k].write) {
+    if (dest->type == OP_TYPE_REG) { emit_rr(0, 0x89, RAX, greg_def(dest->imm)); }
+    else { emit_store(4, pc); }
+  }
+  return true;
+}
+
+/* Compile an instruction inline if it is supported. */
+static bool emit_inline(const TBInstr *in, vaddr_t pc) {
+  if (is_helper_l(in, exec_mov, exec_mov_l)) { return emit_mov(in, pc); }
+
+  int k;
+  for (k = 0; k < NR_ALU; k ++) {
+    if (is_helper_l(in, alu_table[k].execute, alu_table[k].execute_l)) { return emit_alu(in, k, pc); }
+  }
+  return false;
+}
+
+/* Call tb_exec_instr() for the instruction, which also updates eip. */
+static void emit_fallback(const TBInstr *in, vaddr_t pc) {
+  emit_writeback(js.dirty);
+  js.dirty = 0;
+  emit_store_cpu_imm(CPU_OFF(cpu.eip), pc);
+  emit_mov_ri64(RDI, in);
+  emit_call(tb_exec_instr);
+
+  js.loaded = 0;
+  js.cc_op = CC_UNKNOWN;
+  js.cc_width = 0;
+  js.host_flags = false;
+}
+
+/* Make the host flags those of the operation recorded in cpu.cc, if it
+ * is known. Return false otherwise.
+ */
+static bool emit_host_flags() {
+  if (js.host_flags) { return true; }
+  if (js.cc_width != 4) { return false; }
+
+  switch (js.cc_op) {
+    case LAZY_CC_ADD:
+    case LAZY_CC_SUB:
+      emit_rm(0, 0x8b, RAX, RBX, CPU_OFF(cpu.cc.src1));    // mov eax, [cc.src1]
+      emit_rm(0, (js.cc_op == LAZY_CC_ADD ? 0x03 : 0x3b), RAX, RBX, CPU_OFF(cpu.cc.src2));
+      return true;
+    case LAZY_CC_LOGIC:
+      emit_rm(0, 0x8b, RAX, RBX, CPU_OFF(cpu.cc.res));     // mov eax, [cc.res]
+      emit_rr(0, 0x85, RAX, RAX);                          // test eax, eax
+      return true;
+    default: return false;
+  }
+}
+
+/* Compile the last instruction of the block and return. */
+static void emit_last(const TBInstr *in, vaddr_t pc, int count) {
+  if (in->execute == exec_jcc && (in->opcode & 0xe) != CC_P && emit_host_flags()) {
+    emit_writeback(js.dirty);
+    /* jcc taken; the registers are written back with mov, which keeps the flags */
+    emit8(0x0f); emit8(0x80 | (in->opcode & 0xf));
+    uint8_t *taken = p;
+    emit32(0);
+    emit_store_cpu_imm(CPU_OFF(cpu.eip), in->seq_eip);
+    emit_return(count);
+    uint32_t rel = p - (taken + 4);
+    memcpy(taken, &rel, 4);
+    emit_store_cpu_imm(CPU_OFF(cpu.eip), in->jmp_eip);
+    emit_return(count);
+    return;
+  }
+
+  if (in->execute == exec_jmp) {
+    emit_writeback(js.dirty);
+    emit_store_cpu_imm(CPU_OFF(cpu.eip), in->jmp_eip);
+  }
+  else if (emit_inline(in, pc)) {
+    emit_writeback(js.dirty);
+    emit_store_cpu_imm(CPU_OFF(cpu.eip), in->seq_eip);
+  }
+  else {
+    emit_fallback(in, pc);
+  }
+  emit_return(count);
+}
+
+void init_jit() {
+  code_cache = mmap(NULL, JIT_CODE_SIZE, PROT_READ | PROT_WRITE | PROT_EXEC,
+      MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+  Assert(code_cache != MAP_FAILED, "Can not allocate the JIT code cache");
+  code_free = code_cache;
+}
+
+void jit_flush() {
+  code_free = code_cache;
+}
+
+JitCode jit_compile(TBlock *tb) {
+  if (code_free + (tb->nr_instr + 1) * JIT_MAX_INSTR_CODE > code_cache + JIT_CODE_SIZE) {
+    return NULL;
+  }
+
+  js.loaded = js.dirty = 0;
+  js.cc_op = CC_UNKNOWN;
+  js.cc_width = 0;
+  js.host_flags = false;
+  nr_hot2cold = nr_cold2hot = 0;
+
+  /* early exits jump to the epilogue at the start of the cold code */
+  p = cold_buf;
+  emit_epilogue();
+  cold = p;
+
+  p = code_free;
+  emit_prologue();
+
+  int i;
+  vaddr_t pc = tb->eip;
+  for (i = 0; i < tb->nr_instr - 1; i ++) {
+    TBInstr *in = &tb->instr[i];
+    bool is_inline = emit_inline(in, pc);
+    if (!is_inline) { emit_fallback(in, pc); }
+
+    /* leave the block if its code page has been written, which is only
+     * possible when memory is accessed, or if the helper stops NEMU
+     */
+    if (!is_inline || is_mem(&in->src) || is_mem(&in->dest)) {
+      emit_mov_ri64(RAX, tb->pgen);
+      emit_rm(0, 0x81, 7, RAX, 0); emit32(tb->gen);   // cmp dword [rax], gen
+      emit_exit_if(CC_NE, i + 1, (is_inline ? in->seq_eip : 0));
+      js.host_flags = false;
+    }
+    if (!is_inline) {
+      emit_mov_ri64(RAX, &nemu_state);
+      emit_rm(0, 0x81, 7, RAX, 0); emit32(NEMU_RUNNING);
+      emit_exit_if(CC_NE, i + 1, 0);
+    }
+    pc = in->seq_eip;
+  }
+  emit_last(&tb->instr[i], pc, tb->nr_instr);
+
+  /* the cold code follows the block */
+  uint8_t *base = p;
+  int len = cold - cold_buf;
+  Assert(base + len <= code_free + (tb->nr_instr + 1) * JIT_MAX_INSTR_CODE, "JIT code is too long");
+  memcpy(base, cold_buf, len);
+  for (i = 0; i < nr_hot2cold; i ++) {
+    uint32_t rel = base + hot2cold[i].target - (hot2cold[i].field + 4);
+    memcpy(hot2cold[i].field, &rel, 4);
+  }
+  for (i = 0; i < nr_cold2hot; i ++) {
+    uint8_t *field = base + cold2hot[i].field;
+    uint32_t rel = cold2hot[i].target - (field + 4);
+    memcpy(field, &rel, 4);
+  }
+
+  JitCode code = (JitCode)code_free;
+  code_free = base + len;
+  return code;
+}
+
+#else
+
+void init_jit() {
+  if (jit_mode) {
+    Log("JIT is not available in this build, blocks are interpreted");
+  }
+}
+
+#endif
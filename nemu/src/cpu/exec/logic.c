@@ -1,25 +1,32 @@
 #include "cpu/exec.h"
 
-make_EHelper(test) {
-  TODO();
+make_EHelperW(test) {
+  rtl_and(&t2, &id_dest->val, &id_src->val);
+  rtl_update_eflags_lazy(LAZY_CC_LOGIC, &id_dest->val, &id_src->val, &t2, width);
 
   print_asm_template2(test);
 }
 
-make_EHelper(and) {
-  TODO();
+make_EHelperW(and) {
+  rtl_and(&t2, &id_dest->val, &id_src->val);
+  operand_write_width(id_dest, &t2, width);
+  rtl_update_eflags_lazy(LAZY_CC_LOGIC, &id_dest->val, &id_src->val, &t2, width);
 
   print_asm_template2(and);
 }
 
-make_EHelper(xor) {
-  TODO();
+make_EHelperW(xor) {
+  rtl_xor(&t2, &id_dest->val, &id_src->val);
+  operand_write_width(id_dest, &t2, width);
+  rtl_update_eflags_lazy(LAZY_CC_LOGIC, &id_dest->val, &id_src->val, &t2, width);
 
   print_asm_template2(xor);
 }
 
-make_EHelper(or) {
-  TODO();
+make_EHelperW(or) {
+  rtl_or(&t2, &id_dest->val, &id_src->val);
+  operand_write_width(id_dest, &t2, width);
+  rtl_update_eflags_lazy(LAZY_CC_LOGIC, &id_dest->val, &id_src->val, &t2, width);
 
   print_asm_template2(or);
 }
@@ -50,7 +57,7 @@ make_EHelper(setcc) {
   rtl_setcc(&t2, subcode);
   operand_write(id_dest, &t2);
 
-  print_asm("set%s %s", get_cc_name(subcode), id_dest->str);
+  print_asm("set%s %s", get_cc_name(subcode), operand_str(id_dest));
 }
 
 make_EHelper(not) {
@@ -38,6 +38,8 @@ make_EHelper(nemu_trap) {
   printf("\33[1;31mnemu: HIT %s TRAP\33[0m at eip = 0x%08x\n\n",
       (cpu.eax == 0 ? "GOOD" : "BAD"), cpu.eip);
   nemu_state = NEMU_END;
+  nemu_trap_hit = true;
+  nemu_trap_code = cpu.eax;
 
 #ifdef DIFF_TEST
   extern void diff_test_skip_qemu();
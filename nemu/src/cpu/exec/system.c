@@ -1,8 +1,18 @@
 #include "cpu/exec.h"
+#include "cpu/tb.h"
 
 void diff_test_skip_qemu();
 void diff_test_skip_nemu();
 
+/* The virtual address space has changed. Forget everything looked up by
+ * virtual address.
+ */
+static inline void flush_vaddr_caches() {
+  tlb_flush();
+  dcache_flush();
+  tb_flush();
+}
+
 make_EHelper(lidt) {
   TODO();
 
@@ -10,13 +20,23 @@ make_EHelper(lidt) {
 }
 
 make_EHelper(mov_r2cr) {
-  TODO();
+  switch (id_dest->reg) {
+    case 0: cpu.cr0.val = id_src->val; break;
+    case 3: cpu.cr3.val = id_src->val; break;
+    default: panic("unsupported control register cr%d", id_dest->reg);
+  }
+  flush_vaddr_caches();
 
   print_asm("movl %%%s,%%cr%d", reg_name(id_src->reg, 4), id_dest->reg);
 }
 
 make_EHelper(mov_cr2r) {
-  TODO();
+  switch (id_src->reg) {
+    case 0: rtl_li(&t2, cpu.cr0.val); break;
+    case 3: rtl_li(&t2, cpu.cr3.val); break;
+    default: panic("unsupported control register cr%d", id_src->reg);
+  }
+  operand_write(id_dest, &t2);
 
   print_asm("movl %%cr%d,%%%s", id_src->reg, reg_name(id_dest->reg, 4));
 
@@ -25,10 +45,17 @@ make_EHelper(mov_cr2r) {
 #endif
 }
 
+make_EHelper(invlpg) {
+  /* the decoding of instructions in the page may be stale as well */
+  flush_vaddr_caches();
+
+  print_asm_template1(invlpg);
+}
+
 make_EHelper(int) {
   TODO();
 
-  print_asm("int %s", id_dest->str);
+  print_asm("int %s", operand_str(id_dest));
 
 #ifdef DIFF_TEST
   diff_test_skip_nemu();
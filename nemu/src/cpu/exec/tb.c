@@ -0,0 +1,245 @@
+#include "cpu/tb.h"
+#include "cpu/jit.h"
+#include "memory/mmu.h"
+#include "monitor/monitor.h"
+#include "monitor/watchpoint.h"
+#include "all-instr.h"
+
+void exec_wrapper(bool);
+
+#define NR_TB 4096
+#define NR_TB_INSTR (32 * 1024)
+
+static TBlock tb_table[NR_TB];
+static TBInstr tb_instr_pool[NR_TB_INSTR];
+static int tb_instr_free = 0;
+
+/* bumped by tb_flush(), which may be called by an instruction being recorded */
+static uint32_t tb_flush_count = 0;
+
+/* helpers which may transfer control, a block ends after them.
+ * Port I/O ends a block as well, see icount_now().
+ */
+static const EHelper tb_end_helpers[] = {
+  exec_jmp, exec_jcc, exec_jmp_rm, exec_call, exec_call_rm, exec_ret,
+  exec_int, exec_iret, exec_mov_r2cr, exec_invlpg, exec_inv, exec_nemu_trap,
+  exec_in, exec_out
+};
+
+#define NR_TB_END_HELPERS (sizeof(tb_end_helpers) / sizeof(tb_end_helpers[0]))
+
+/* Blocks are looked up by eip, so they are flushed when the virtual
+ * address space changes.
+ */
+void tb_flush() {
+  int i;
+  for (i = 0; i < NR_TB; i ++) {
+    tb_table[i].eip = -1;
+    tb_table[i].succ[0] = tb_table[i].succ[1] = NULL;
+  }
+  tb_instr_free = 0;
+  tb_flush_count ++;
+
+#ifdef HAS_JIT
+  jit_flush();
+#endif
+}
+
+void init_tb() {
+  init_jit();
+  tb_flush();
+}
+
+static inline bool tb_is_end(EHelper execute) {
+  int i;
+  for (i = 0; i < NR_TB_END_HELPERS; i ++) {
+    if (tb_end_helpers[i] == execute) { return true; }
+  }
+  return false;
+}
+
+static inline bool tb_valid(TBlock *tb, vaddr_t eip) {
+  return tb->eip == eip && tb->gen == *tb->pgen;
+}
+
+TBlock* tb_lookup(vaddr_t eip) {
+  TBlock *tb = &tb_table[eip % NR_TB];
+  return (tb_valid(tb, eip) ? tb : NULL);
+}
+
+/* Find the block to run after `tb' at `eip', following and recording the links. */
+TBlock* tb_chain(TBlock *tb, vaddr_t eip) {
+  int i = (eip == tb->instr[tb->nr_instr - 1].seq_eip);
+  if (tb->succ[i] != NULL && tb_valid(tb->succ[i], eip)) {
+    return tb->succ[i];
+  }
+
+  TBlock *next = tb_lookup(eip);
+  if (next != NULL) {
+    tb->succ[i] = next;
+  }
+  return next;
+}
+
+static void tb_operand_record(TBOperand *r, const Operand *op) {
+  r->type = op->type;
+  r->width = op->width;
+  r->load_width = op->load_width;
+  r->base = op->mem.base;
+  r->index = op->mem.index;
+  r->scale = op->mem.scale;
+  r->val = op->val;
+
+  if (op->type == OP_TYPE_MEM) {
+    r->imm = op->mem.disp;
+    r->recipe = (op->load == OP_LOAD_MEM ? TB_OP_MEM_LOAD : TB_OP_MEM);
+  }
+  else {
+    r->imm = op->imm;
+    r->recipe = TB_OP_CONST;
+    if (op->load == OP_LOAD_REG) {
+      r->recipe = (op->load_width == 4 ? TB_OP_REG_L : (op->load_width == 2 ? TB_OP_REG_W : TB_OP_REG_B));
+    }
+  }
+}
+
+static void tb_instr_record(TBInstr *in, const DCacheEntry *e) {
+  in->execute = e->execute;
+  in->seq_eip = e->eip + e->len;
+  in->jmp_eip = e->info.jmp_eip;
+  in->opcode = e->info.opcode;
+  in->is_operand_size_16 = e->info.is_operand_size_16;
+  tb_operand_record(&in->src, &e->info.src);
+  tb_operand_record(&in->dest, &e->info.dest);
+  tb_operand_record(&in->src2, &e->info.src2);
+}
+
+/* Execute instructions one by one from the current eip, recording their
+ * decodings into a new block. `*n' is decreased by the number of executed
+ * instructions.
+ */
+TBlock* tb_translate(uint64_t *n) {
+  if (tb_instr_free + MAX_TB_INSTR > NR_TB_INSTR) {
+    tb_flush();
+  }
+
+  vaddr_t eip = cpu.eip;
+  paddr_t paddr = page_translate(eip, MEM_EXEC);
+  if (pmem_map_host(paddr) == NULL) {
+    /* code outside RAM is interpreted */
+    exec_wrapper(false);
+    (*n) --;
+    return NULL;
+  }
+
+  uint32_t *pgen = &pmem_page_gen_of(paddr);
+  uint32_t gen = *pgen;
+  uint32_t flush_count = tb_flush_count;
+  TBlock *tb = &tb_table[eip % NR_TB];
+  TBInstr *instr = &tb_instr_pool[tb_instr_free];
+  int nr_instr = 0;
+
+  tb->eip = -1;
+  while (*n > 0) {
+    vaddr_t pc = cpu.eip;
+    exec_wrapper(false);
+    (*n) --;
+
+    DCacheEntry *e = dcache_lookup(pc);
+    if (e == NULL || ((pc ^ eip) & ~PAGE_MASK) || *pgen != gen || tb_flush_count != flush_count) {
+      break;
+    }
+
+    tb_instr_record(&instr[nr_instr ++], e);
+    if (nr_instr == MAX_TB_INSTR || tb_is_end(e->execute) ||
+        cpu.eip != pc + e->len || nemu_state != NEMU_RUNNING) {
+      break;
+    }
+  }
+
+  /* a flush while recording has freed the slots of the block */
+  if (nr_instr == 0 || tb_flush_count != flush_count) { return NULL; }
+
+  tb->eip = eip;
+  tb->pgen = pgen;
+  tb->gen = gen;
+  tb->nr_instr = nr_instr;
+  tb->instr = instr;
+  tb->succ[0] = tb->succ[1] = NULL;
+  tb->nr_exec = 0;
+  tb->jit_code = NULL;
+  tb_instr_free += nr_instr;
+  return tb;
+}
+
+/* Prepare an operand for the helper, as operand_reload() does for a decoding. */
+static inline void tb_operand_load(Operand *op, const TBOperand *r) {
+  op->type = r->type;
+  op->width = r->width;
+  op->imm = r->imm;
+  op->val = r->val;
+
+  /* register numbers have been checked by the decoder */
+  switch (r->recipe) {
+    case TB_OP_REG_L: op->val = cpu.gpr[r->imm]._32; break;
+    case TB_OP_REG_W: op->val = cpu.gpr[r->imm]._16; break;
+    case TB_OP_REG_B: op->val = cpu.gpr[r->imm & 0x3]._8[r->imm >> 2]; break;
+    case TB_OP_MEM:
+    case TB_OP_MEM_LOAD:
+      /* `addr' starts from the displacement in `imm' */
+      if (r->base != -1) { op->addr += cpu.gpr[r->base]._32; }
+      if (r->index != -1) { op->addr += cpu.gpr[r->index]._32 << r->scale; }
+      if (r->recipe == TB_OP_MEM_LOAD) { op->val = vaddr_read(op->addr, r->load_width); }
+      break;
+    default: break;
+  }
+}
+
+/* Execute an instruction of a block and update eip. Only the fields read
+ * by the helpers are written to `decoding'.
+ */
+static inline void tb_exec_one(const TBInstr *in) {
+  decoding.opcode = in->opcode;
+  decoding.seq_eip = in->seq_eip;
+  decoding.jmp_eip = in->jmp_eip;
+  decoding.is_operand_size_16 = in->is_operand_size_16;
+  tb_operand_load(&decoding.src, &in->src);
+  tb_operand_load(&decoding.dest, &in->dest);
+  tb_operand_load(&decoding.src2, &in->src2);
+
+  in->execute(&decoding.seq_eip);
+  decoding.is_operand_size_16 = false;
+  update_eip();
+}
+
+/* for compiled blocks, which call it for instructions not compiled inline */
+void tb_exec_instr(const TBInstr *in) {
+  tb_exec_one(in);
+}
+
+/* Return the number of executed instructions. The block is left early
+ * if its code page is written by itself.
+ */
+int tb_exec(TBlock *tb) {
+#ifdef HAS_JIT
+  /* compiled code only stops at the end of the block */
+  if (tb->jit_code != NULL && nr_watch_mem == 0) {
+    return ((JitCode)tb->jit_code)();
+  }
+
+  if (jit_mode && ++ tb->nr_exec == JIT_HOT_THRESHOLD) {
+    tb->jit_code = jit_compile(tb);
+    if (tb->jit_code == NULL) {
+      /* the code cache is full, start over */
+      tb_flush();
+    }
+  }
+#endif
+
+  int i = 0;
+  while (i < tb->nr_instr) {
+    tb_exec_one(&tb->instr[i ++]);
+    if (*tb->pgen != tb->gen || nemu_state != NEMU_RUNNING) { break; }
+  }
+  return i;
+}
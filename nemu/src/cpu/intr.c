@@ -1,5 +1,6 @@
 #include "cpu/exec.h"
 #include "memory/mmu.h"
+#include "monitor/perf.h"
 
 void raise_intr(uint8_t NO, vaddr_t ret_addr) {
   /* TODO: Trigger an interrupt/exception with ``NO''.
@@ -10,4 +11,5 @@ void raise_intr(uint8_t NO, vaddr_t ret_addr) {
 }
 
 void dev_raise_intr() {
+  perf.intr ++;
 }
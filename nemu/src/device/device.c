@@ -2,57 +2,38 @@
 
 #ifdef HAS_IOE
 
-#include <sys/time.h>
-#include <signal.h>
+#include "device/event.h"
 #include <SDL2/SDL.h>
 
 #define TIMER_HZ 100
 #define VGA_HZ 50
 
-static uint64_t jiffy = 0;
-static struct itimerval it;
-static int device_update_flag = false;
-static int update_screen_flag = false;
-
 void init_serial();
 void init_timer();
 void init_vga();
 void init_i8042();
+void init_pmu();
 
 extern void timer_intr();
 extern void send_key(uint8_t, bool);
 extern void update_screen();
+extern void vga_invalidate();
+extern bool vga_headless;
 
-
-static void timer_sig_handler(int signum) {
-  jiffy ++;
+static void timer_event() {
   timer_intr();
-
-  device_update_flag = true;
-  if (jiffy % (TIMER_HZ / VGA_HZ) == 0) {
-    update_screen_flag = true;
-  }
-
-  int ret = setitimer(ITIMER_VIRTUAL, &it, NULL);
-  Assert(ret == 0, "Can not set timer");
-}
-
-void device_update() {
-  if (!device_update_flag) {
-    return;
-  }
-  device_update_flag = false;
-
-  if (update_screen_flag) {
-    update_screen();
-    update_screen_flag = false;
-  }
+  if (vga_headless) { return; }
 
   SDL_Event event;
   while (SDL_PollEvent(&event)) {
     switch (event.type) {
       case SDL_QUIT: exit(0);
 
+      /* the window is redrawn only when the screen changes */
+      case SDL_WINDOWEVENT:
+                     if (event.window.event == SDL_WINDOWEVENT_EXPOSED) { vga_invalidate(); }
+                     break;
+
                      // If a key was pressed
       case SDL_KEYDOWN:
       case SDL_KEYUP: {
@@ -68,7 +49,12 @@ void device_update() {
   }
 }
 
+static void vga_event() {
+  update_screen();
+}
+
 void sdl_clear_event_queue() {
+  if (vga_headless) { return; }
   SDL_Event event;
   while (SDL_PollEvent(&event));
 }
@@ -78,17 +64,10 @@ void init_device() {
   init_timer();
   init_vga();
   init_i8042();
+  init_pmu();
 
-  struct sigaction s;
-  memset(&s, 0, sizeof(s));
-  s.sa_handler = timer_sig_handler;
-  int ret = sigaction(SIGVTALRM, &s, NULL);
-  Assert(ret == 0, "Can not set signal handler");
-
-  it.it_value.tv_sec = 0;
-  it.it_value.tv_usec = 1000000 / TIMER_HZ;
-  ret = setitimer(ITIMER_VIRTUAL, &it, NULL);
-  Assert(ret == 0, "Can not set timer");
+  add_event(timer_event, EVENT_HOST, 1000000 / TIMER_HZ);
+  add_event(vga_event, EVENT_HOST, 1000000 / VGA_HZ);
 }
 #else
 
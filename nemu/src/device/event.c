@@ -0,0 +1,120 @@
+#include "device/event.h"
+#include "device/replay.h"
+
+#include <time.h>
+
+#define NR_EVENT 8
+
+/* The host clock is read at least once every this many instructions
+ * when there are events in host time.
+ */
+#define HOST_CHECK_INTERVAL 16384
+
+/* Granularity of guest time in icount mode, since `icount' is only
+ * updated between batches.
+ */
+#define ICOUNT_CLOCK_US 100
+
+typedef struct {
+  event_handler_t handler;
+  int unit;
+  uint64_t period;
+  uint64_t deadline;
+} Event;
+
+static Event events[NR_EVENT];
+static int nr_event = 0;
+static bool has_host_event = false;
+static uint64_t next_icount_deadline = UINT64_MAX;
+
+uint64_t icount = 0;
+uint32_t icount_mips = 0;
+
+static uint64_t host_time() {
+  struct timespec now;
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  return now.tv_sec * 1000000ull + now.tv_nsec / 1000;
+}
+
+uint64_t guest_time_us() {
+  static uint64_t boot_time = 0;
+  if (icount_mips != 0) {
+    return icount / icount_mips;
+  }
+
+  if (boot_time == 0) { boot_time = host_time(); }
+  return host_time() - boot_time;
+}
+
+static inline uint64_t event_now(Event *e, uint64_t now) {
+  return (e->unit == EVENT_ICOUNT ? icount : now);
+}
+
+void add_event(event_handler_t handler, int unit, uint64_t period) {
+  assert(nr_event < NR_EVENT);
+  assert(period > 0);
+
+  if (unit == EVENT_HOST && icount_mips != 0) {
+    /* run on the virtual clock */
+    unit = EVENT_ICOUNT;
+    period *= icount_mips;
+  }
+
+  Event *e = &events[nr_event ++];
+  e->handler = handler;
+  e->unit = unit;
+  e->period = period;
+  e->deadline = event_now(e, unit == EVENT_HOST ? host_time() : 0) + period;
+
+  if (unit == EVENT_HOST) { has_host_event = true; }
+  else if (e->deadline < next_icount_deadline) { next_icount_deadline = e->deadline; }
+}
+
+/* How many of the next `n' instructions can run before an event is due. */
+uint64_t event_budget(uint64_t n) {
+  uint64_t left = next_icount_deadline - icount;
+  uint64_t replay_left = replay_deadline() - icount;
+  if (replay_left < left) { left = replay_left; }
+  if (left < n) { n = left; }
+  if (has_host_event && n > HOST_CHECK_INTERVAL) { n = HOST_CHECK_INTERVAL; }
+  if (icount_mips != 0 && n > ICOUNT_CLOCK_US * icount_mips) { n = ICOUNT_CLOCK_US * icount_mips; }
+  return (n == 0 ? 1 : n);
+}
+
+/* Account for `executed' instructions and fire the events which are due. */
+void event_advance(uint64_t executed) {
+  icount += executed;
+  replay_advance();
+  if (nr_event == 0) { return; }
+
+  uint64_t now = (has_host_event ? host_time() : 0);
+  int i;
+  next_icount_deadline = UINT64_MAX;
+  for (i = 0; i < nr_event; i ++) {
+    Event *e = &events[i];
+    uint64_t t = event_now(e, now);
+    if (t >= e->deadline) {
+      e->deadline = t + e->period;
+      e->handler();
+    }
+    if (e->unit == EVENT_ICOUNT && e->deadline < next_icount_deadline) {
+      next_icount_deadline = e->deadline;
+    }
+  }
+}
+
+/* Restart all events after `icount' is changed by loading a snapshot.
+ * The phase of an event is not saved, so it is due one period from now.
+ */
+void event_restore() {
+  uint64_t now = (has_host_event ? host_time() : 0);
+  int i;
+  next_icount_deadline = UINT64_MAX;
+  for (i = 0; i < nr_event; i ++) {
+    Event *e = &events[i];
+    e->deadline = event_now(e, now) + e->period;
+    if (e->unit == EVENT_ICOUNT && e->deadline < next_icount_deadline) {
+      next_icount_deadline = e->deadline;
+    }
+  }
+}
@@ -1,5 +1,9 @@
 #include "common.h"
 #include "device/mmio.h"
+#include "memory/memory.h"
+#include "memory/mmu.h"
+#include "monitor/snapshot.h"
+#include "monitor/perf.h"
 
 #define MMIO_SPACE_MAX (512 * 1024)
 #define NR_MAP 8
@@ -12,35 +16,44 @@ typedef struct {
   paddr_t high;
   uint8_t *mmio_space;
   mmio_callback_t callback;
+  PerfMap *perf;
 } MMIO_t;
 
 static MMIO_t maps[NR_MAP];
 static int nr_map = 0;
 
+/* map number + 1 of each physical page, 0 for pages not in any MMIO space */
+static uint8_t mmio_page_map[NR_PMEM_MAP];
+
 /* device interface */
-void* add_mmio_map(paddr_t addr, int len, mmio_callback_t callback) {
+void* add_mmio_map(const char *name, paddr_t addr, int len, mmio_callback_t callback) {
+  /* MMIO spaces are managed in pages by the physical memory map */
+  len = (len + PAGE_SIZE - 1) & ~PAGE_MASK;
   assert(nr_map < NR_MAP);
   assert(mmio_space_free_index + len <= MMIO_SPACE_MAX);
+  pmem_map_mmio(addr, len);
+
+  int i;
+  for (i = 0; i < len; i += PAGE_SIZE) {
+    assert(mmio_page_map[(addr + i) >> 12] == 0);
+    mmio_page_map[(addr + i) >> 12] = nr_map + 1;
+  }
 
   uint8_t *space_base = &mmio_space_pool[mmio_space_free_index];
   maps[nr_map].low = addr;
   maps[nr_map].high = addr + len - 1;
   maps[nr_map].mmio_space = space_base;
   maps[nr_map].callback = callback;
+  maps[nr_map].perf = perf_add_map(name, true);
   nr_map ++;
   mmio_space_free_index += len;
+  add_snapshot_region("mmio", space_base, len);
   return space_base;
 }
 
 /* bus interface */
 int is_mmio(paddr_t addr) {
-  int i;
-  for (i = 0; i < nr_map; i ++) {
-    if (addr >= maps[i].low && addr <= maps[i].high) {
-      return i;
-    }
-  }
-  return -1;
+  return (int)mmio_page_map[addr >> 12] - 1;
 }
 
 uint32_t mmio_read(paddr_t addr, int len, int map_NO) {
@@ -48,6 +61,7 @@ uint32_t mmio_read(paddr_t addr, int len, int map_NO) {
   MMIO_t *map = &maps[map_NO];
   uint32_t data = *(uint32_t *)(map->mmio_space + (addr - map->low)) 
     & (~0u >> ((4 - len) << 3));
+  map->perf->read ++;
   map->callback(addr, len, false);
   return data;
 }
@@ -66,5 +80,6 @@ void mmio_write(paddr_t addr, int len, uint32_t data, int map_NO) {
     case 1: p[0] = p_data[0]; break;
   }
 
-  maps[map_NO].callback(addr, len, true);
+  map->perf->write ++;
+  map->callback(addr, len, true);
 }
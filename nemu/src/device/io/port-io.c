@@ -1,5 +1,7 @@
 #include "common.h"
 #include "device/port-io.h"
+#include "monitor/snapshot.h"
+#include "monitor/perf.h"
 
 #define PORT_IO_SPACE_MAX 65536
 #define NR_MAP 8
@@ -11,6 +13,7 @@ typedef struct {
   ioaddr_t low;
   ioaddr_t high;
   pio_callback_t callback;
+  PerfMap *perf;
 } PIO_t;
 
 static PIO_t maps[NR_MAP];
@@ -20,6 +23,8 @@ static void pio_callback(ioaddr_t addr, int len, bool is_write) {
   int i;
   for (i = 0; i < nr_map; i ++) {
     if (addr >= maps[i].low && addr + len - 1 <= maps[i].high) {
+      if (is_write) { maps[i].perf->write ++; }
+      else { maps[i].perf->read ++; }
       maps[i].callback(addr, len, is_write);
       return;
     }
@@ -27,13 +32,15 @@ static void pio_callback(ioaddr_t addr, int len, bool is_write) {
 }
 
 /* device interface */
-void* add_pio_map(ioaddr_t addr, int len, pio_callback_t callback) {
+void* add_pio_map(const char *name, ioaddr_t addr, int len, pio_callback_t callback) {
   assert(nr_map < NR_MAP);
   assert(addr + len <= PORT_IO_SPACE_MAX);
   maps[nr_map].low = addr;
   maps[nr_map].high = addr + len - 1;
   maps[nr_map].callback = callback;
+  maps[nr_map].perf = perf_add_map(name, false);
   nr_map ++;
+  add_snapshot_region("pio", pio_space + addr, len);
   return pio_space + addr;
 }
 
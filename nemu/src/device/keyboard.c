@@ -1,5 +1,7 @@
 #include "device/port-io.h"
 #include "monitor/monitor.h"
+#include "device/replay.h"
+#include "monitor/snapshot.h"
 #include <SDL2/SDL.h>
 
 #define I8042_DATA_PORT 0x60
@@ -38,7 +40,8 @@ static int key_f = 0, key_r = 0;
 #define KEYDOWN_MASK 0x8000
 
 void send_key(uint8_t scancode, bool is_keydown) {
-  if (nemu_state == NEMU_RUNNING &&
+  /* keys come from the log when replaying */
+  if (nemu_state == NEMU_RUNNING && replay_mode != REPLAY_PLAY &&
       keymap[scancode] != _KEY_NONE) {
     uint32_t am_scancode = keymap[scancode] | (is_keydown ? KEYDOWN_MASK : 0);
     key_queue[key_r] = am_scancode;
@@ -53,10 +56,18 @@ void i8042_io_handler(ioaddr_t addr, int len, bool is_write) {
     }
     else if (addr == I8042_STATUS_PORT) {
       if ((i8042_status_port_base[0] & I8042_STATUS_HASKEY_MASK) == 0) {
-        if (key_f != key_r) {
+        if (replay_mode == REPLAY_PLAY) {
+          uint64_t key;
+          if (replay_fetch(REPLAY_KEY, &key)) {
+            i8042_data_port_base[0] = key;
+            i8042_status_port_base[0] |= I8042_STATUS_HASKEY_MASK;
+          }
+        }
+        else if (key_f != key_r) {
           i8042_data_port_base[0] = key_queue[key_f];
           i8042_status_port_base[0] |= I8042_STATUS_HASKEY_MASK;
           key_f = (key_f + 1) % KEY_QUEUE_LEN;
+          replay_log(REPLAY_KEY, i8042_data_port_base[0]);
         }
       }
     }
@@ -64,7 +75,11 @@ void i8042_io_handler(ioaddr_t addr, int len, bool is_write) {
 }
 
 void init_i8042() {
-  i8042_data_port_base = add_pio_map(I8042_DATA_PORT, 4, i8042_io_handler);
-  i8042_status_port_base = add_pio_map(I8042_STATUS_PORT, 1, i8042_io_handler);
+  i8042_data_port_base = add_pio_map("i8042-data", I8042_DATA_PORT, 4, i8042_io_handler);
+  i8042_status_port_base = add_pio_map("i8042-status", I8042_STATUS_PORT, 1, i8042_io_handler);
   i8042_status_port_base[0] = 0x0;
+
+  add_snapshot_region("key_queue", key_queue, sizeof(key_queue));
+  add_snapshot_region("key_f", &key_f, sizeof(key_f));
+  add_snapshot_region("key_r", &key_r, sizeof(key_r));
 }
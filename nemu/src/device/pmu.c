@@ -0,0 +1,133 @@
+#include "device/port-io.h"
+#include "device/event.h"
+#include "device/replay.h"
+#include "monitor/perf.h"
+#include "monitor/snapshot.h"
+#include <inttypes.h>
+#include <time.h>
+
+#define PMU_PORT 0x50   // Note that this is not the standard
+
+/* Performance monitoring unit, with 32-bit registers:
+ *
+ *   PMU_PORT + 0x0  SELECT  the counter accessed by the registers below
+ *   PMU_PORT + 0x4  EVENT   the event counted by the selected counter,
+ *                           writing it also clears the counter
+ *   PMU_PORT + 0x8  LO      reading it latches the selected counter and
+ *                           returns the low 32 bits
+ *   PMU_PORT + 0xc  HI      the high 32 bits latched
+ *
+ * Counter 0 counts the retired instructions, counter 1 the virtual cycles,
+ * and the NR_PMU_COUNTER counters after them count events programmed by the
+ * guest. Port I/O ends a translation block, so instructions are counted
+ * exactly in every execution mode.
+ *
+ * PMU_EV_TLB_MISS counts the refills of the software TLB of NEMU. Blocks
+ * fetch their instructions only when they are translated, and fetches
+ * share the TLB with data accesses, so the count depends on the execution
+ * mode and only runs in the same mode can be compared.
+ */
+
+enum { PMU_SELECT, PMU_EVENT, PMU_LO, PMU_HI, NR_PMU_REG };
+enum { PMU_INSTRET, PMU_CYCLES, PMU_COUNTER0 };
+
+#define NR_PMU_COUNTER 4
+
+/* keep the same as _PERF_* in nexus-am */
+enum {
+  PMU_EV_NONE, PMU_EV_INSTR, PMU_EV_CYCLES, PMU_EV_TLB_MISS, PMU_EV_INTR,
+  PMU_EV_PIO, PMU_EV_MMIO, NR_PMU_EV
+};
+
+/* The rate of virtual cycles. They run on the virtual clock with --icount,
+ * and on the host clock otherwise, going through the replay log as the RTC.
+ */
+#define PMU_CYCLE_MHZ 1000
+
+static uint32_t *pmu_port_base;
+
+static struct {
+  uint32_t event[NR_PMU_COUNTER];
+  uint64_t start[NR_PMU_COUNTER];   // the event count when the counter was cleared
+} pmu;
+
+static uint64_t boot_ns;
+
+static uint64_t host_ns() {
+  struct timespec now;
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  return now.tv_sec * 1000000000ull + now.tv_nsec;
+}
+
+static uint64_t cycles() {
+  if (icount_mips != 0) {
+    return icount_now() * PMU_CYCLE_MHZ / icount_mips;
+  }
+
+  uint64_t v;
+  if (replay_mode == REPLAY_PLAY) {
+    if (!replay_fetch(REPLAY_CYCLES, &v)) {
+      panic("Replay diverged at instruction %" PRIu64 ": cycle counter read is not in the log", icount_now());
+    }
+    return v;
+  }
+
+  v = (host_ns() - boot_ns) * PMU_CYCLE_MHZ / 1000;
+  replay_log(REPLAY_CYCLES, v);
+  return v;
+}
+
+static uint64_t event_count(uint32_t ev) {
+  switch (ev) {
+    case PMU_EV_INSTR: return icount_now();
+    case PMU_EV_CYCLES: return cycles();
+    case PMU_EV_TLB_MISS: return perf.tlb_miss;
+    case PMU_EV_INTR: return perf.intr;
+    case PMU_EV_PIO: return perf_map_total(false);
+    case PMU_EV_MMIO: return perf_map_total(true);
+    default: return 0;
+  }
+}
+
+static uint64_t counter_value(uint32_t NO) {
+  switch (NO) {
+    case PMU_INSTRET: return icount_now();
+    case PMU_CYCLES: return cycles();
+  }
+
+  NO -= PMU_COUNTER0;
+  if (NO >= NR_PMU_COUNTER) { return 0; }
+  return event_count(pmu.event[NO]) - pmu.start[NO];
+}
+
+void pmu_io_handler(ioaddr_t addr, int len, bool is_write) {
+  assert(len == 4);
+  int reg = (addr - PMU_PORT) >> 2;
+  /* the selected programmable counter, invalid if it is not one */
+  uint32_t NO = pmu_port_base[PMU_SELECT] - PMU_COUNTER0;
+
+  if (is_write) {
+    if (reg == PMU_EVENT && NO < NR_PMU_COUNTER) {
+      uint32_t ev = pmu_port_base[PMU_EVENT];
+      pmu.event[NO] = (ev < NR_PMU_EV ? ev : PMU_EV_NONE);
+      pmu.start[NO] = event_count(pmu.event[NO]);
+    }
+    return;
+  }
+
+  if (reg == PMU_EVENT) {
+    pmu_port_base[PMU_EVENT] = (NO < NR_PMU_COUNTER ? pmu.event[NO] : PMU_EV_NONE);
+  }
+  else if (reg == PMU_LO) {
+    uint64_t v = counter_value(pmu_port_base[PMU_SELECT]);
+    pmu_port_base[PMU_LO] = v;
+    pmu_port_base[PMU_HI] = v >> 32;
+  }
+}
+
+void init_pmu() {
+  pmu_port_base = add_pio_map("pmu", PMU_PORT, NR_PMU_REG * 4, pmu_io_handler);
+  boot_ns = host_ns();
+
+  add_snapshot_region("pmu", &pmu, sizeof(pmu));
+}
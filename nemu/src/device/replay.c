@@ -0,0 +1,152 @@
+#include "device/replay.h"
+#include "device/event.h"
+
+#include <inttypes.h>
+#include <stdlib.h>
+
+int replay_mode = REPLAY_OFF;
+
+static FILE *replay_fp = NULL;
+static uint64_t last_icount = 0;
+static uint32_t last_rtc = 0;
+static uint64_t last_cycles = 0;
+
+/* the next record to replay */
+static struct {
+  int kind;
+  uint64_t icount;
+  uint64_t value;
+} next;
+
+static void put_varint(uint64_t v) {
+  while (v >= 0x80) {
+    fputc((v & 0x7f) | 0x80, replay_fp);
+    v >>= 7;
+  }
+  fputc(v, replay_fp);
+}
+
+static bool get_varint(uint64_t *v) {
+  int c, shift = 0;
+  *v = 0;
+  do {
+    if ((c = fgetc(replay_fp)) == EOF || shift > 63) { return false; }
+    *v |= (uint64_t)(c & 0x7f) << shift;
+    shift += 7;
+  } while (c & 0x80);
+  return true;
+}
+
+/* Log an input received by the current instruction. */
+void replay_log(int kind, uint64_t value) {
+  if (replay_mode != REPLAY_RECORD) { return; }
+
+  uint64_t now = icount_now();
+  if (kind == REPLAY_RTC) {
+    uint32_t v = value;
+    value = (uint32_t)(v - last_rtc);
+    last_rtc = v;
+  }
+  else if (kind == REPLAY_CYCLES) {
+    uint64_t v = value;
+    value -= last_cycles;
+    last_cycles = v;
+  }
+
+  fputc(kind, replay_fp);
+  put_varint(now - last_icount);
+  put_varint(value);
+  last_icount = now;
+}
+
+static void replay_next() {
+  int kind = fgetc(replay_fp);
+  uint64_t delta, value;
+  if (kind == EOF || !get_varint(&delta) || !get_varint(&value)) {
+    /* the devices are live from now on */
+    Log("End of the replay log at instruction %" PRIu64, icount_now());
+    fclose(replay_fp);
+    replay_mode = REPLAY_OFF;
+    return;
+  }
+
+  next.kind = kind;
+  next.icount += delta;
+  next.value = value;
+  if (kind == REPLAY_RTC) {
+    next.value = (uint32_t)(next.value + last_rtc);
+    last_rtc = next.value;
+  }
+  else if (kind == REPLAY_CYCLES) {
+    next.value += last_cycles;
+    last_cycles = next.value;
+  }
+}
+
+static inline void replay_check(bool cond, uint64_t now) {
+  if (!cond) {
+    panic("Replay diverged at instruction %" PRIu64 ": expecting input of kind %d at instruction %" PRIu64,
+        now, next.kind, next.icount);
+  }
+}
+
+/* If the current instruction received an input of `kind' in the log, take
+ * it from the log and return true.
+ */
+bool replay_fetch(int kind, uint64_t *value) {
+  uint64_t now = icount_now();
+  if (next.icount > now) { return false; }
+  replay_check(next.icount == now && next.kind == kind, now);
+
+  *value = next.value;
+  replay_next();
+  return true;
+}
+
+/* The instruction count which the current batch must not run past. A batch
+ * stops before a logged interrupt, or after an instruction with logged input
+ * to see what comes next.
+ */
+uint64_t replay_deadline() {
+  if (replay_mode != REPLAY_PLAY) { return UINT64_MAX; }
+  return next.icount + (next.kind != REPLAY_INTR);
+}
+
+/* Raise the interrupts logged at the current instruction count. */
+void replay_advance() {
+  while (replay_mode == REPLAY_PLAY && next.icount <= icount) {
+    replay_check(next.icount == icount, icount);
+    if (next.kind != REPLAY_INTR) { break; }
+
+    extern void dev_raise_intr(void);
+    dev_raise_intr();
+    replay_next();
+  }
+}
+
+static void replay_close() {
+  if (replay_mode == REPLAY_RECORD) {
+    fclose(replay_fp);
+  }
+}
+
+void init_replay(const char *file, int mode) {
+  replay_fp = fopen(file, mode == REPLAY_RECORD ? "wb" : "rb");
+  Assert(replay_fp, "Can not open '%s'", file);
+
+  ReplayHeader h = { .magic = REPLAY_MAGIC, .version = REPLAY_VERSION };
+  if (mode == REPLAY_RECORD) {
+    fwrite(&h, sizeof(h), 1, replay_fp);
+    atexit(replay_close);
+  }
+  else {
+    ReplayHeader f;
+    Assert(fread(&f, sizeof(f), 1, replay_fp) == 1 && f.magic == h.magic && f.version == h.version,
+        "'%s' is not a NEMU replay log", file);
+  }
+
+  replay_mode = mode;
+  if (mode == REPLAY_PLAY) {
+    replay_next();
+  }
+}
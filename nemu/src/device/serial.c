@@ -24,6 +24,6 @@ void serial_io_handler(ioaddr_t addr, int len, bool is_write) {
 }
 
 void init_serial() {
-  serial_port_base = add_pio_map(SERIAL_PORT, 8, serial_io_handler);
+  serial_port_base = add_pio_map("serial", SERIAL_PORT, 8, serial_io_handler);
   serial_port_base[LSR_OFFSET] = 0x20; /* the status is always free */
 }
@@ -1,11 +1,16 @@
 #include "device/port-io.h"
 #include "monitor/monitor.h"
+#include "device/event.h"
+#include "device/replay.h"
 #include <sys/time.h>
+#include <inttypes.h>
 
 #define RTC_PORT 0x48   // Note that this is not the standard
 
 void timer_intr() {
-  if (nemu_state == NEMU_RUNNING) {
+  /* interrupts are raised by the log when replaying */
+  if (nemu_state == NEMU_RUNNING && replay_mode != REPLAY_PLAY) {
+    replay_log(REPLAY_INTR, 0);
     extern void dev_raise_intr(void);
     dev_raise_intr();
   }
@@ -14,15 +19,32 @@ void timer_intr() {
 static uint32_t *rtc_port_base;
 
 void rtc_io_handler(ioaddr_t addr, int len, bool is_write) {
-  if (!is_write) {
+  if (is_write) { return; }
+
+  if (replay_mode == REPLAY_PLAY) {
+    uint64_t v;
+    if (!replay_fetch(REPLAY_RTC, &v)) {
+      panic("Replay diverged at instruction %" PRIu64 ": RTC read is not in the log", icount_now());
+    }
+    rtc_port_base[0] = v;
+    return;
+  }
+
+  if (icount_mips != 0) {
+    /* milliseconds since boot on the virtual clock */
+    rtc_port_base[0] = guest_time_us() / 1000;
+  }
+  else {
     struct timeval now;
     gettimeofday(&now, NULL);
     uint32_t seconds = now.tv_sec;
     uint32_t useconds = now.tv_usec;
     rtc_port_base[0] = seconds * 1000 + (useconds + 500) / 1000;
   }
+
+  replay_log(REPLAY_RTC, rtc_port_base[0]);
 }
 
 void init_timer() {
-  rtc_port_base = add_pio_map(RTC_PORT, 4, rtc_io_handler);
+  rtc_port_base = add_pio_map("rtc", RTC_PORT, 4, rtc_io_handler);
 }
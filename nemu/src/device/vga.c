@@ -1,5 +1,13 @@
 #include "common.h"
 
+/* With --headless, the screen is only kept in vmem, and no SDL function
+ * is called. With --frame-dump, the screen is written to files named by
+ * the pattern with the frame number, once every `frame_interval' refreshes.
+ */
+bool vga_headless = false;
+const char *frame_dump = NULL;
+int frame_interval = 1;
+
 #ifdef HAS_IOE
 
 #include "device/mmio.h"
@@ -16,23 +24,136 @@ static SDL_Texture *texture;
 
 static uint32_t (*vmem) [SCREEN_W];
 
+/* The written pixels of each scanline are in [x0, x1), none if x0 >= x1.
+ * Only they are uploaded to the texture when the screen is updated.
+ */
+static struct {
+  uint16_t x0, x1;
+} dirty[SCREEN_H];
+static bool screen_dirty = false;
+
+static inline void mark_dirty(uint32_t pixel) {
+  if (pixel >= SCREEN_W * SCREEN_H) { return; }
+  int y = pixel / SCREEN_W, x = pixel % SCREEN_W;
+  if (x < dirty[y].x0) { dirty[y].x0 = x; }
+  if (x + 1 > dirty[y].x1) { dirty[y].x1 = x + 1; }
+  screen_dirty = true;
+}
+
 void vga_vmem_io_handler(paddr_t addr, int len, bool is_write) {
+  if (!is_write) { return; }
+  /* an unaligned write may touch two pixels */
+  uint32_t offset = addr - VMEM;
+  mark_dirty(offset / sizeof(vmem[0][0]));
+  mark_dirty((offset + len - 1) / sizeof(vmem[0][0]));
+}
+
+/* Redraw the whole screen at the next update. */
+void vga_invalidate() {
+  int y;
+  for (y = 0; y < SCREEN_H; y ++) {
+    dirty[y].x0 = 0;
+    dirty[y].x1 = SCREEN_W;
+  }
+  screen_dirty = true;
+}
+
+/* Write the screen as a binary PPM if `file' ends with `.ppm', or as
+ * the raw ARGB pixels otherwise.
+ */
+bool vga_dump(const char *file) {
+  FILE *fp = fopen(file, "wb");
+  if (fp == NULL) {
+    printf("Can not open '%s'\n", file);
+    return false;
+  }
+
+  bool ok;
+  int len = strlen(file);
+  if (len >= 4 && strcmp(file + len - 4, ".ppm") == 0) {
+    static uint8_t rgb[SCREEN_H][SCREEN_W][3];
+    int x, y;
+    for (y = 0; y < SCREEN_H; y ++) {
+      for (x = 0; x < SCREEN_W; x ++) {
+        rgb[y][x][0] = vmem[y][x] >> 16;
+        rgb[y][x][1] = vmem[y][x] >> 8;
+        rgb[y][x][2] = vmem[y][x];
+      }
+    }
+    ok = fprintf(fp, "P6\n%d %d\n255\n", SCREEN_W, SCREEN_H) > 0 &&
+      fwrite(rgb, sizeof(rgb), 1, fp) == 1;
+  }
+  else {
+    ok = fwrite(vmem, SCREEN_W * SCREEN_H * sizeof(vmem[0][0]), 1, fp) == 1;
+  }
+
+  ok = (fclose(fp) == 0) && ok;
+  if (!ok) { printf("Can not write the screen to '%s'\n", file); }
+  return ok;
+}
+
+static void dump_frame() {
+  static uint32_t nr_refresh = 0;
+  uint32_t n = nr_refresh ++;
+  if (n % frame_interval != 0) { return; }
+
+  char file[256];
+  snprintf(file, sizeof(file), frame_dump, n / frame_interval);
+  vga_dump(file);
 }
 
 void update_screen() {
-  SDL_UpdateTexture(texture, NULL, vmem, SCREEN_W * sizeof(vmem[0][0]));
+  if (frame_dump != NULL) { dump_frame(); }
+  if (vga_headless) { return; }
+
+  /* nothing to present if nothing is written */
+  if (!screen_dirty) { return; }
+
+  /* each run of dirty scanlines is uploaded as one rectangle */
+  int y = 0;
+  while (y < SCREEN_H) {
+    if (dirty[y].x0 >= dirty[y].x1) {
+      y ++;
+      continue;
+    }
+
+    int x0 = SCREEN_W, x1 = 0, y1;
+    for (y1 = y; y1 < SCREEN_H && dirty[y1].x0 < dirty[y1].x1; y1 ++) {
+      if (dirty[y1].x0 < x0) { x0 = dirty[y1].x0; }
+      if (dirty[y1].x1 > x1) { x1 = dirty[y1].x1; }
+      dirty[y1].x0 = SCREEN_W;
+      dirty[y1].x1 = 0;
+    }
+
+    SDL_Rect rect = { .x = x0, .y = y, .w = x1 - x0, .h = y1 - y };
+    SDL_UpdateTexture(texture, &rect, &vmem[y][x0], SCREEN_W * sizeof(vmem[0][0]));
+    y = y1;
+  }
+  screen_dirty = false;
+
   SDL_RenderClear(renderer);
   SDL_RenderCopy(renderer, texture, NULL, NULL);
   SDL_RenderPresent(renderer);
 }
 
 void init_vga() {
-  SDL_Init(SDL_INIT_VIDEO);
-  SDL_CreateWindowAndRenderer(SCREEN_W * 2, SCREEN_H * 2, 0, &window, &renderer);
-  SDL_SetWindowTitle(window, "NEMU");
-  texture = SDL_CreateTexture(renderer, SDL_PIXELFORMAT_ARGB8888,
-      SDL_TEXTUREACCESS_STATIC, SCREEN_W, SCREEN_H);
+  if (frame_dump != NULL) {
+    /* the pattern takes the frame number and nothing else */
+    const char *p = strchr(frame_dump, '%');
+    Assert(p != NULL && p[1 + strspn(p + 1, "0123456789")] == 'd' && strchr(p + 1, '%') == NULL,
+        "the pattern of --frame-dump should have one %%d, as in 'frame%%05d.ppm'");
+    Assert(frame_interval > 0, "invalid frame interval %d", frame_interval);
+  }
+
+  if (!vga_headless) {
+    SDL_Init(SDL_INIT_VIDEO);
+    SDL_CreateWindowAndRenderer(SCREEN_W * 2, SCREEN_H * 2, 0, &window, &renderer);
+    SDL_SetWindowTitle(window, "NEMU");
+    texture = SDL_CreateTexture(renderer, SDL_PIXELFORMAT_ARGB8888,
+        SDL_TEXTUREACCESS_STATIC, SCREEN_W, SCREEN_H);
+  }
 
-  vmem = add_mmio_map(VMEM, 0x80000, vga_vmem_io_handler);
+  vmem = add_mmio_map("vmem", VMEM, 0x80000, vga_vmem_io_handler);
+  vga_invalidate();
 }
 #endif	/* HAS_IOE */
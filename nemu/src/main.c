@@ -1,12 +1,20 @@
 int init_monitor(int, char *[]);
 void ui_mainloop(int);
+void server_mainloop(void);
+extern int server_jobs;
 
 int main(int argc, char *argv[]) {
   /* Initialize the monitor. */
   int is_batch_mode = init_monitor(argc, argv);
 
-  /* Receive commands from user. */
-  ui_mainloop(is_batch_mode);
+  /* Run jobs in forked children in the server mode,
+   * or receive commands from user. */
+  if (server_jobs > 0) {
+    server_mainloop();
+  }
+  else {
+    ui_mainloop(is_batch_mode);
+  }
 
   return 0;
 }
@@ -1,28 +1,288 @@
 #include "nemu.h"
+#include "memory/mmu.h"
+#include "device/mmio.h"
+#include "monitor/watchpoint.h"
+#include "monitor/perf.h"
+#include <stdlib.h>
 
-#define PMEM_SIZE (128 * 1024 * 1024)
+/* page aligned, so that pages of a snapshot can be mapped in place */
+uint8_t pmem[PMEM_SIZE] __attribute__((aligned(PAGE_SIZE)));
+uint32_t pmem_page_gen[PMEM_SIZE / PAGE_SIZE];
+uint8_t pmem_page_dirty[PMEM_SIZE / PAGE_SIZE];
 
-#define pmem_rw(addr, type) *(type *)({\
-    Assert(addr < PMEM_SIZE, "physical address(0x%08x) is out of bound", addr); \
-    guest_to_host(addr); \
-    })
+/* Physical memory map, one entry per page of the physical address space.
+ * RAM pages hold the host address of the page, while MMIO and unmapped
+ * pages hold NULL and are dispatched in the slow path. Bounds are checked
+ * when the map is built, so RAM accesses only need one table lookup.
+ */
+uint8_t *pmem_map[NR_PMEM_MAP];
 
-uint8_t pmem[PMEM_SIZE];
+#define cross_page(addr, len) ((((addr) + (len) - 1) ^ (addr)) & ~PAGE_MASK)
+
+void init_pmem_map() {
+  paddr_t addr;
+  for (addr = 0; addr < PMEM_SIZE; addr += PAGE_SIZE) {
+    pmem_map_host(addr) = guest_to_host(addr);
+  }
+}
+
+void pmem_map_mmio(paddr_t addr, int len) {
+  Assert((addr & PAGE_MASK) == 0 && (len & PAGE_MASK) == 0 && len > 0,
+      "MMIO space [0x%08x, 0x%08x) is not page aligned", addr, addr + len);
+  Assert(addr + len - 1 >= addr, "MMIO space at 0x%08x is out of bound", addr);
+
+  int i;
+  for (i = 0; i < len; i += PAGE_SIZE) {
+    pmem_map_host(addr + i) = NULL;
+  }
+
+  /* the TLB may hold host pointers of the pages */
+  tlb_flush();
+}
+
+/* Mark pages as written, for data put into memory by NEMU itself. */
+void pmem_touch(paddr_t addr, int len) {
+  paddr_t p;
+  for (p = addr & ~PAGE_MASK; p < addr + len; p += PAGE_SIZE) {
+    pmem_page_gen_of(p) ++;
+    pmem_page_dirty_of(p) = 1;
+  }
+}
+
+#ifdef MEM_WRITE_LOG
+uint64_t mem_write_hash = 0;
+
+static inline uint64_t hash_write(vaddr_t addr, int len, uint32_t data) {
+  /* the finalizer of splitmix64 */
+  uint64_t h = ((uint64_t)addr << 32 | data) ^ ((uint64_t)len << 60);
+  h = (h ^ (h >> 30)) * 0xbf58476d1ce4e5b9ull;
+  h = (h ^ (h >> 27)) * 0x94d049bb133111ebull;
+  return h ^ (h >> 31);
+}
+
+typedef struct {
+  uint8_t *host;
+  int len;
+  uint32_t old;
+} UndoEntry;
+
+static UndoEntry *undo_log = NULL;
+static int nr_undo = 0, undo_size = 0;
+static bool undo_enabled = false;
+
+static inline void undo_push(uint8_t *host, int len) {
+  if (!undo_enabled) { return; }
+  if (nr_undo == undo_size) {
+    undo_size = (undo_size == 0 ? 1024 : undo_size * 2);
+    undo_log = realloc(undo_log, undo_size * sizeof(undo_log[0]));
+    assert(undo_log != NULL);
+  }
+  UndoEntry *u = &undo_log[nr_undo ++];
+  u->host = host;
+  u->len = len;
+  memcpy(&u->old, host, len);
+}
+
+void mem_checkpoint() {
+  undo_enabled = true;
+  nr_undo = 0;
+}
+
+/* Restore the memory to the last checkpoint. The caller should flush
+ * everything cached about the memory and the registers.
+ */
+void mem_rewind() {
+  while (nr_undo > 0) {
+    UndoEntry *u = &undo_log[-- nr_undo];
+    memcpy(u->host, &u->old, u->len);
+    pmem_page_gen_of(host_to_guest(u->host)) ++;
+  }
+}
+#else
+#define undo_push(host, len)
+#endif
 
 /* Memory accessing interfaces */
 
+static uint32_t paddr_read_slow(paddr_t addr, int len) {
+  if (cross_page(addr, len)) {
+    uint32_t data = 0;
+    int i;
+    for (i = 0; i < len; i ++) {
+      data |= paddr_read(addr + i, 1) << (i << 3);
+    }
+    return data;
+  }
+
+  int map_NO = is_mmio(addr);
+  Assert(map_NO != -1, "physical address(0x%08x) is out of bound", addr);
+  return mmio_read(addr, len, map_NO);
+}
+
+static void paddr_write_slow(paddr_t addr, int len, uint32_t data) {
+  if (cross_page(addr, len)) {
+    int i;
+    for (i = 0; i < len; i ++) {
+      paddr_write(addr + i, 1, data >> (i << 3));
+    }
+    return;
+  }
+
+  int map_NO = is_mmio(addr);
+  Assert(map_NO != -1, "physical address(0x%08x) is out of bound", addr);
+  mmio_write(addr, len, data, map_NO);
+}
+
 uint32_t paddr_read(paddr_t addr, int len) {
-  return pmem_rw(addr, uint32_t) & (~0u >> ((4 - len) << 3));
+  uint8_t *host = pmem_map_host(addr);
+  if (host != NULL && !cross_page(addr, len)) {
+    return *(uint32_t *)(host + (addr & PAGE_MASK)) & (~0u >> ((4 - len) << 3));
+  }
+  return paddr_read_slow(addr, len);
 }
 
 void paddr_write(paddr_t addr, int len, uint32_t data) {
-  memcpy(guest_to_host(addr), &data, len);
+  uint8_t *host = pmem_map_host(addr);
+  if (host != NULL && !cross_page(addr, len)) {
+    undo_push(host + (addr & PAGE_MASK), len);
+    memcpy(host + (addr & PAGE_MASK), &data, len);
+    pmem_page_gen_of(addr) ++;
+    pmem_page_dirty_of(addr) = 1;
+    return;
+  }
+  paddr_write_slow(addr, len, data);
 }
 
-uint32_t vaddr_read(vaddr_t addr, int len) {
+TLBEntry tlb[NR_TLB];
+
+void tlb_flush() {
+  int i;
+  for (i = 0; i < NR_TLB; i ++) {
+    tlb[i].tag[MEM_READ] = tlb[i].tag[MEM_WRITE] = tlb[i].tag[MEM_EXEC] = -1;
+  }
+}
+
+/* Walk the page table, setting the accessed and dirty bits as the hardware does. */
+static PTE page_walk(vaddr_t addr, bool is_write) {
+  paddr_t pde_addr = (cpu.cr3.page_directory_base << 12) + ((addr >> 22) << 2);
+  PDE pde;
+  pde.val = paddr_read(pde_addr, 4);
+  Assert(pde.present, "invalid PDE for address 0x%08x, eip = 0x%08x", addr, cpu.eip);
+  if (!pde.accessed) {
+    pde.accessed = 1;
+    paddr_write(pde_addr, 4, pde.val);
+  }
+
+  paddr_t pte_addr = (pde.page_frame << 12) + (((addr >> 12) & 0x3ff) << 2);
+  PTE pte;
+  pte.val = paddr_read(pte_addr, 4);
+  Assert(pte.present, "invalid PTE for address 0x%08x, eip = 0x%08x", addr, cpu.eip);
+  if (!pte.accessed || (is_write && !pte.dirty)) {
+    pte.accessed = 1;
+    pte.dirty |= is_write;
+    paddr_write(pte_addr, 4, pte.val);
+  }
+
+  return pte;
+}
+
+static TLBEntry* tlb_fill(vaddr_t addr, int type) {
+  perf.tlb_miss ++;
+  PTE pte = page_walk(addr, type == MEM_WRITE);
+  vaddr_t vpage = addr & ~PAGE_MASK;
+  paddr_t ppage = pte.page_frame << 12;
+  TLBEntry *e = tlb_entry(addr);
+
+  e->tag[MEM_READ] = e->tag[MEM_WRITE] = e->tag[MEM_EXEC] = -1;
+  e->ppage = ppage;
+
+  if (pmem_map_host(ppage) != NULL) {
+    e->host = pmem_map_host(ppage);
+    e->pgen = &pmem_page_gen_of(ppage);
+    e->tag[MEM_READ] = e->tag[MEM_EXEC] = vpage;
+    /* writes should walk the page table until the dirty bit is set,
+     * and writes to pages with memory watchpoints are always checked
+     */
+    if (pte.dirty && (nr_watch_mem == 0 || !watch_page(vpage))) {
+      e->tag[MEM_WRITE] = vpage;
+    }
+  }
+
+  return e;
+}
+
+paddr_t page_translate(vaddr_t addr, int type) {
+  if (!cpu.cr0.paging) { return addr; }
+
+  TLBEntry *e = tlb_entry(addr);
+  if (e->tag[type] != (addr & ~PAGE_MASK)) {
+    e = tlb_fill(addr, type);
+  }
+  return e->ppage | (addr & PAGE_MASK);
+}
+
+static inline uint32_t vaddr_read_type(vaddr_t addr, int len, int type) {
+  if (cpu.cr0.paging) {
+    TLBEntry *e = tlb_entry(addr);
+    if (e->tag[type] == (addr & ~PAGE_MASK) && !cross_page(addr, len)) {
+      return *(uint32_t *)(e->host + (addr & PAGE_MASK)) & (~0u >> ((4 - len) << 3));
+    }
+
+    if (cross_page(addr, len)) {
+      uint32_t data = 0;
+      int i;
+      for (i = 0; i < len; i ++) {
+        data |= vaddr_read_type(addr + i, 1, type) << (i << 3);
+      }
+      return data;
+    }
+
+    addr = page_translate(addr, type);
+  }
+
   return paddr_read(addr, len);
 }
 
+uint32_t vaddr_read(vaddr_t addr, int len) {
+  return vaddr_read_type(addr, len, MEM_READ);
+}
+
+uint32_t vaddr_ifetch(vaddr_t addr, int len) {
+  return vaddr_read_type(addr, len, MEM_EXEC);
+}
+
+static void vaddr_write_real(vaddr_t addr, int len, uint32_t data) {
+  paddr_t paddr = addr;
+  if (cpu.cr0.paging) {
+    TLBEntry *e = tlb_entry(addr);
+    if (e->tag[MEM_WRITE] == (addr & ~PAGE_MASK) && !cross_page(addr, len)) {
+      undo_push(e->host + (addr & PAGE_MASK), len);
+      memcpy(e->host + (addr & PAGE_MASK), &data, len);
+      (*e->pgen) ++;
+      pmem_page_dirty_of(e->ppage) = 1;
+      return;
+    }
+
+    if (cross_page(addr, len)) {
+      int i;
+      for (i = 0; i < len; i ++) {
+        vaddr_write_real(addr + i, 1, data >> (i << 3));
+      }
+      return;
+    }
+
+    paddr = page_translate(addr, MEM_WRITE);
+  }
+
+  if (nr_watch_mem > 0) {
+    watch_write(addr, len, data);
+  }
+  paddr_write(paddr, len, data);
+}
+
 void vaddr_write(vaddr_t addr, int len, uint32_t data) {
-  paddr_write(addr, len, data);
+#ifdef MEM_WRITE_LOG
+  mem_write_hash += hash_write(addr, len, data & (~0u >> ((4 - len) << 3)));
+#endif
+  vaddr_write_real(addr, len, data);
 }
@@ -1,5 +1,10 @@
 #include "nemu.h"
 #include "monitor/monitor.h"
+#include "cpu/tb.h"
+#include "device/event.h"
+#include "monitor/watchpoint.h"
+#include "monitor/prof.h"
+#include "monitor/perf.h"
 
 /* The assembly code of instructions executed is only output to the screen
  * when the number of instructions executed is less than this value.
@@ -9,8 +14,97 @@
 #define MAX_INSTR_TO_PRINT 10
 
 int nemu_state = NEMU_STOP;
+int nemu_trap_hit = false;
+int nemu_trap_code = 0;
+
+/* Execute by translation blocks instead of instruction by instruction. */
+bool tb_mode = false;
 
 void exec_wrapper(bool);
+bool exec_needs_decoding(void);
+
+/* Instructions left in the current batch, including the one being executed.
+ * Port I/O ends a translation block, so an instruction which accesses a
+ * device is always the last one of what is being executed.
+ */
+static uint64_t batch_n = 0, batch_left = 0;
+
+uint64_t icount_now() {
+  return icount + (batch_n - batch_left);
+}
+
+/* Move the instruction count, for instructions which are undone or run
+ * outside of the batch by diff-test.
+ */
+void icount_adjust(int64_t delta) {
+  icount += delta;
+  perf.instr += delta;
+}
+
+/* `nemu_state' is only checked at block boundaries. */
+static void cpu_exec_tb() {
+  TBlock *tb = NULL;
+
+  while (batch_left > 0) {
+    TBlock *next = (tb != NULL ? tb_chain(tb, cpu.eip) : tb_lookup(cpu.eip));
+    if (next == NULL) {
+      tb = tb_translate(&batch_left);
+    }
+    else if (next->nr_instr <= batch_left) {
+      uint64_t left = batch_left;
+      /* Only the last instruction of a block may do port I/O. Count the
+       * others in advance, so that icount_now() is exact when it runs.
+       */
+      batch_left -= next->nr_instr - 1;
+      batch_left = left - tb_exec(next);
+      tb = next;
+    }
+    else {
+      /* not enough budget for the whole block */
+      exec_wrapper(false);
+      batch_left --;
+      tb = NULL;
+    }
+
+    if (nemu_state != NEMU_RUNNING) { break; }
+  }
+}
+
+static uint64_t cpu_exec_batch(uint64_t n, bool print_flag) {
+  batch_n = batch_left = n;
+
+  /* Expression watchpoints and the exact profiler work instruction by
+   * instruction. Blocks only keep what the helpers read, so they are not
+   * used either when the whole decoding of every instruction is wanted.
+   */
+  if (tb_mode && !print_flag && nr_watch_expr == 0 && !prof_exact && !exec_needs_decoding()) {
+    cpu_exec_tb();
+  }
+  else {
+    while (batch_left > 0) {
+      /* Execute one instruction, including instruction fetch,
+       * instruction decode, and the actual execution. */
+      vaddr_t eip = cpu.eip;
+      uint32_t esp = reg_l(R_ESP);
+      exec_wrapper(print_flag);
+      batch_left --;
+
+      if (prof_exact) { prof_count(eip, esp); }
+
+#ifdef DEBUG
+      if (nr_watch_expr > 0 && check_watch_expr()) {
+        nemu_state = NEMU_STOP;
+      }
+#endif
+
+      if (nemu_state != NEMU_RUNNING) { break; }
+    }
+  }
+
+  uint64_t executed = n - batch_left;
+  batch_n = batch_left = 0;
+  return executed;
+}
 
 /* Simulate how the CPU works. */
 void cpu_exec(uint64_t n) {
@@ -19,26 +113,26 @@ void cpu_exec(uint64_t n) {
     return;
   }
   nemu_state = NEMU_RUNNING;
+  perf_start();
 
   bool print_flag = n < MAX_INSTR_TO_PRINT;
 
-  for (; n > 0; n --) {
-    /* Execute one instruction, including instruction fetch,
-     * instruction decode, and the actual execution. */
-    exec_wrapper(print_flag);
-
-#ifdef DEBUG
-    /* TODO: check watchpoints here. */
+  /* Run instructions in batches, which end when a device event is due. */
+  while (n > 0) {
+    uint64_t executed = cpu_exec_batch(event_budget(n), print_flag);
+    n -= executed;
+    perf.instr += executed;
+    event_advance(executed);
 
-#endif
+    if (nemu_state != NEMU_RUNNING) { break; }
+  }
 
-#ifdef HAS_IOE
-    extern void device_update();
-    device_update();
+#ifdef DIFF_TEST
+  /* NEMU is checked up to where it stops */
+  void difftest_flush();
+  difftest_flush();
 #endif
 
-    if (nemu_state != NEMU_RUNNING) { return; }
-  }
-
   if (nemu_state == NEMU_RUNNING) { nemu_state = NEMU_STOP; }
+  perf_stop();
 }
@@ -1,4 +1,8 @@
 #include "nemu.h"
+#include "monitor/expr.h"
+#include "monitor/symbol.h"
+
+#include <stdlib.h>
 
 /* We use the POSIX regex functions to process regular expressions.
  * Type 'man regex' for more information about POSIX regex functions.
@@ -7,10 +11,8 @@
 #include <regex.h>
 
 enum {
-  TK_NOTYPE = 256, TK_EQ
-
-  /* TODO: Add more token types */
-
+  TK_NOTYPE = 256, TK_EQ, TK_NEQ, TK_LE, TK_GE, TK_AND, TK_OR,
+  TK_HEX, TK_DEC, TK_REG, TK_SYM
 };
 
 static struct rule {
@@ -18,13 +20,28 @@ static struct rule {
   int token_type;
 } rules[] = {
 
-  /* TODO: Add more rules.
-   * Pay attention to the precedence level of different rules.
-   */
+  /* Pay attention to the precedence level of different rules. */
 
   {" +", TK_NOTYPE},    // spaces
+  {"0[xX][0-9a-fA-F]+", TK_HEX},
+  {"[0-9]+", TK_DEC},
+  {"\\$[a-zA-Z]+", TK_REG},
+  {"[a-zA-Z_][a-zA-Z0-9_]*", TK_SYM},
+  {"==", TK_EQ},        // equal
+  {"!=", TK_NEQ},
+  {"<=", TK_LE},
+  {">=", TK_GE},
+  {"&&", TK_AND},
+  {"\\|\\|", TK_OR},
+  {"<", '<'},
+  {">", '>'},
   {"\\+", '+'},         // plus
-  {"==", TK_EQ}         // equal
+  {"-", '-'},
+  {"\\*", '*'},
+  {"/", '/'},
+  {"!", '!'},
+  {"\\(", '('},
+  {"\\)", ')'},
 };
 
 #define NR_REGEX (sizeof(rules) / sizeof(rules[0]) )
@@ -53,8 +70,9 @@ typedef struct token {
   char str[32];
 } Token;
 
-Token tokens[32];
-int nr_token;
+/* grown as needed, the tokens are only used when compiling */
+static Token *tokens = NULL;
+static int nr_token, token_size = 0;
 
 static bool make_token(char *e) {
   int position = 0;
@@ -70,19 +88,23 @@ static bool make_token(char *e) {
         char *substr_start = e + position;
         int substr_len = pmatch.rm_eo;
 
-        Log("match rules[%d] = \"%s\" at position %d with len %d: %.*s",
-            i, rules[i].regex, position, substr_len, substr_len, substr_start);
         position += substr_len;
 
-        /* TODO: Now a new token is recognized with rules[i]. Add codes
-         * to record the token in the array `tokens'. For certain types
-         * of tokens, some extra actions should be performed.
-         */
-
-        switch (rules[i].token_type) {
-          default: TODO();
+        if (rules[i].token_type == TK_NOTYPE) { break; }
+        if (substr_len >= sizeof(tokens[0].str)) {
+          printf("token too long at position %d\n", position - substr_len);
+          return false;
         }
 
+        if (nr_token == token_size) {
+          token_size = (token_size == 0 ? 32 : token_size * 2);
+          tokens = realloc(tokens, token_size * sizeof(tokens[0]));
+          assert(tokens != NULL);
+        }
+        Token *t = &tokens[nr_token ++];
+        t->type = rules[i].token_type;
+        memcpy(t->str, substr_start, substr_len);
+        t->str[substr_len] = '\0';
         break;
       }
     }
@@ -96,14 +118,232 @@ static bool make_token(char *e) {
   return true;
 }
 
+/* The bytecode. Operands of an instruction follow it in the next word. */
+enum {
+  OP_IMM,                         // push the operand
+  OP_REG32, OP_REG16, OP_REG8,    // push the register numbered by the operand
+  OP_EIP,
+  OP_DEREF,                       // replace the address on the top with 4 bytes there
+  OP_NEG, OP_NOT, OP_BOOL,
+  OP_ADD, OP_SUB, OP_MUL, OP_DIV,
+  OP_EQ, OP_NEQ, OP_LT, OP_GT, OP_LE, OP_GE,
+  OP_AND,     // if the top is 0 jump to the operand, otherwise pop it
+  OP_OR,      // if the top is not 0 make it 1 and jump to the operand, otherwise pop it
+  OP_END
+};
+
+struct Expr {
+  int depth;      // the maximum depth of the stack
+  uint32_t code[];
+};
+
+static uint32_t *code = NULL;
+static int code_len, code_size = 0;
+static int depth, max_depth;
+static int pos;
+
+static int emit(uint32_t x) {
+  if (code_len == code_size) {
+    code_size = (code_size == 0 ? 64 : code_size * 2);
+    code = realloc(code, code_size * sizeof(code[0]));
+    assert(code != NULL);
+  }
+  code[code_len] = x;
+  return code_len ++;
+}
+
+/* `n' is the change of the stack depth */
+static void emit_op(int op, int n) {
+  emit(op);
+  depth += n;
+  if (depth > max_depth) { max_depth = depth; }
+}
+
+static bool compile_expr(int prec);
+
+static bool compile_reg(const char *name) {
+  int i;
+  for (i = 0; i < 8; i ++) {
+    int op = (strcmp(name, regsl[i]) == 0 ? OP_REG32 :
+        strcmp(name, regsw[i]) == 0 ? OP_REG16 :
+        strcmp(name, regsb[i]) == 0 ? OP_REG8 : -1);
+    if (op != -1) {
+      emit_op(op, 1);
+      emit(i);
+      return true;
+    }
+  }
+  if (strcmp(name, "eip") == 0) {
+    emit_op(OP_EIP, 1);
+    return true;
+  }
+
+  printf("unknown register '$%s'\n", name);
+  return false;
+}
+
+static bool compile_unary() {
+  if (pos == nr_token) {
+    printf("unexpected end of the expression\n");
+    return false;
+  }
+
+  Token *t = &tokens[pos ++];
+  switch (t->type) {
+    case '-': if (!compile_unary()) { return false; } emit_op(OP_NEG, 0); return true;
+    case '!': if (!compile_unary()) { return false; } emit_op(OP_NOT, 0); return true;
+    case '*': if (!compile_unary()) { return false; } emit_op(OP_DEREF, 0); return true;
+    case '(':
+      if (!compile_expr(0)) { return false; }
+      if (pos == nr_token || tokens[pos].type != ')') {
+        printf("missing ')'\n");
+        return false;
+      }
+      pos ++;
+      return true;
+    case TK_HEX:
+    case TK_DEC:
+      emit_op(OP_IMM, 1);
+      emit(strtoul(t->str, NULL, t->type == TK_HEX ? 16 : 10));
+      return true;
+    case TK_REG:
+      return compile_reg(t->str + 1);
+    case TK_SYM: {
+      /* a symbol stands for its address */
+      vaddr_t addr;
+      if (!symbol_lookup(t->str, &addr)) {
+        printf("no symbol '%s'\n", t->str);
+        return false;
+      }
+      emit_op(OP_IMM, 1);
+      emit(addr);
+      return true;
+    }
+    default:
+      printf("unexpected '%s'\n", t->str);
+      return false;
+  }
+}
+
+static const struct {
+  int type, prec, op;
+} binary_ops[] = {
+  { TK_OR, 1, OP_OR }, { TK_AND, 2, OP_AND },
+  { TK_EQ, 3, OP_EQ }, { TK_NEQ, 3, OP_NEQ },
+  { '<', 4, OP_LT }, { '>', 4, OP_GT }, { TK_LE, 4, OP_LE }, { TK_GE, 4, OP_GE },
+  { '+', 5, OP_ADD }, { '-', 5, OP_SUB },
+  { '*', 6, OP_MUL }, { '/', 6, OP_DIV },
+};
+
+#define NR_BINARY_OP (sizeof(binary_ops) / sizeof(binary_ops[0]))
+
+/* Compile operators binding tighter than `prec', by precedence climbing. */
+static bool compile_expr(int prec) {
+  if (!compile_unary()) { return false; }
+
+  while (pos < nr_token) {
+    int i;
+    for (i = 0; i < NR_BINARY_OP && binary_ops[i].type != tokens[pos].type; i ++);
+    if (i == NR_BINARY_OP || binary_ops[i].prec <= prec) { return true; }
+    pos ++;
+
+    int op = binary_ops[i].op;
+    if (op == OP_AND || op == OP_OR) {
+      /* short-circuit, the operand is patched below */
+      emit_op(op, 0);
+      int target = emit(0);
+      depth --;
+      if (!compile_expr(binary_ops[i].prec)) { return false; }
+      emit_op(OP_BOOL, 0);
+      code[target] = code_len;
+    }
+    else {
+      if (!compile_expr(binary_ops[i].prec)) { return false; }
+      emit_op(op, -1);
+    }
+  }
+  return true;
+}
+
+/* Return NULL with the error printed if `e' is invalid. */
+Expr* expr_compile(char *e) {
+  if (!make_token(e)) { return NULL; }
+
+  code_len = depth = max_depth = pos = 0;
+  if (!compile_expr(0)) { return NULL; }
+  if (pos != nr_token) {
+    printf("unexpected '%s'\n", tokens[pos].str);
+    return NULL;
+  }
+  emit_op(OP_END, 0);
+
+  Expr *ex = malloc(sizeof(Expr) + code_len * sizeof(code[0]));
+  assert(ex != NULL);
+  ex->depth = max_depth;
+  memcpy(ex->code, code, code_len * sizeof(code[0]));
+  return ex;
+}
+
+uint32_t expr_eval(Expr *ex, bool *success) {
+  uint32_t stack[ex->depth + 1];
+  uint32_t *sp = stack - 1;   // the top
+  uint32_t *pc = ex->code;
+
+  *success = true;
+  while (1) {
+    switch (*pc ++) {
+      case OP_IMM: *(++ sp) = *pc ++; break;
+      case OP_REG32: *(++ sp) = reg_l(*pc); pc ++; break;
+      case OP_REG16: *(++ sp) = reg_w(*pc); pc ++; break;
+      case OP_REG8: *(++ sp) = reg_b(*pc); pc ++; break;
+      case OP_EIP: *(++ sp) = cpu.eip; break;
+      case OP_DEREF: *sp = vaddr_read(*sp, 4); break;
+      case OP_NEG: *sp = - *sp; break;
+      case OP_NOT: *sp = !*sp; break;
+      case OP_BOOL: *sp = (*sp != 0); break;
+      case OP_ADD: sp --; sp[0] += sp[1]; break;
+      case OP_SUB: sp --; sp[0] -= sp[1]; break;
+      case OP_MUL: sp --; sp[0] *= sp[1]; break;
+      case OP_DIV:
+        sp --;
+        if (sp[1] == 0) {
+          *success = false;
+          return 0;
+        }
+        sp[0] /= sp[1];
+        break;
+      case OP_EQ: sp --; sp[0] = (sp[0] == sp[1]); break;
+      case OP_NEQ: sp --; sp[0] = (sp[0] != sp[1]); break;
+      case OP_LT: sp --; sp[0] = (sp[0] < sp[1]); break;
+      case OP_GT: sp --; sp[0] = (sp[0] > sp[1]); break;
+      case OP_LE: sp --; sp[0] = (sp[0] <= sp[1]); break;
+      case OP_GE: sp --; sp[0] = (sp[0] >= sp[1]); break;
+      case OP_AND:
+        if (*sp == 0) { pc = ex->code + *pc; }
+        else { sp --; pc ++; }
+        break;
+      case OP_OR:
+        if (*sp != 0) { *sp = 1; pc = ex->code + *pc; }
+        else { sp --; pc ++; }
+        break;
+      case OP_END: return *sp;
+      default: panic("invalid bytecode");
+    }
+  }
+}
+
+void expr_free(Expr *ex) {
+  free(ex);
+}
+
 uint32_t expr(char *e, bool *success) {
-  if (!make_token(e)) {
+  Expr *ex = expr_compile(e);
+  if (ex == NULL) {
     *success = false;
     return 0;
   }
 
-  /* TODO: Insert codes to evaluate the expression. */
-  TODO();
-
-  return 0;
+  uint32_t val = expr_eval(ex, success);
+  expr_free(ex);
+  return val;
 }
@@ -0,0 +1,110 @@
+#include "nemu.h"
+#include "monitor/monitor.h"
+#include "monitor/perf.h"
+
+#include <inttypes.h>
+#include <time.h>
+
+#define NR_PERF_MAP 16
+
+PerfCounters perf;
+
+static PerfMap maps[NR_PERF_MAP];
+static int nr_map = 0;
+
+static const char *json_file = NULL;
+static uint64_t wall_start, cpu_start;
+
+/* Register a device map, whose accesses are counted by the returned counters. */
+PerfMap* perf_add_map(const char *name, bool is_mmio) {
+  assert(nr_map < NR_PERF_MAP);
+  PerfMap *m = &maps[nr_map ++];
+  strncpy(m->name, name, sizeof(m->name) - 1);
+  m->is_mmio = is_mmio;
+  return m;
+}
+
+/* accesses to all MMIO or PIO maps */
+uint64_t perf_map_total(bool is_mmio) {
+  uint64_t n = 0;
+  int i;
+  for (i = 0; i < nr_map; i ++) {
+    if (maps[i].is_mmio == is_mmio) { n += maps[i].read + maps[i].write; }
+  }
+  return n;
+}
+
+static uint64_t now_ns(clockid_t clock) {
+  struct timespec t;
+  clock_gettime(clock, &t);
+  return t.tv_sec * 1000000000ull + t.tv_nsec;
+}
+
+static double mips() {
+  return perf.wall_ns == 0 ? 0.0 : perf.instr * 1000.0 / perf.wall_ns;
+}
+
+static void write_json() {
+  FILE *fp = fopen(json_file, "w");
+  if (fp == NULL) {
+    printf("Can not open '%s'\n", json_file);
+    return;
+  }
+
+  fprintf(fp, "{\n  \"result\": \"%s\",\n  \"trap_code\": %d,\n",
+      !nemu_trap_hit ? "ABORT" : nemu_trap_code == 0 ? "GOOD" : "BAD", nemu_trap_code);
+  fprintf(fp, "  \"instr\": %" PRIu64 ",\n", perf.instr);
+  fprintf(fp, "  \"dcache_hit\": %" PRIu64 ",\n", perf.dcache_hit);
+  fprintf(fp, "  \"dcache_miss\": %" PRIu64 ",\n", perf.dcache_miss);
+  fprintf(fp, "  \"tlb_miss\": %" PRIu64 ",\n", perf.tlb_miss);
+  fprintf(fp, "  \"intr\": %" PRIu64 ",\n", perf.intr);
+  fprintf(fp, "  \"wall_s\": %.6f,\n", perf.wall_ns / 1e9);
+  fprintf(fp, "  \"cpu_s\": %.6f,\n", perf.cpu_ns / 1e9);
+  fprintf(fp, "  \"mips\": %.3f,\n", mips());
+  fprintf(fp, "  \"maps\": [");
+  int i;
+  for (i = 0; i < nr_map; i ++) {
+    fprintf(fp, "%s\n    { \"name\": \"%s\", \"type\": \"%s\", \"read\": %" PRIu64 ", \"write\": %" PRIu64 " }",
+        i == 0 ? "" : ",", maps[i].name, maps[i].is_mmio ? "mmio" : "pio", maps[i].read, maps[i].write);
+  }
+  fprintf(fp, "%s]\n}\n", nr_map == 0 ? "" : "\n  ");
+
+  if (fclose(fp) != 0) { printf("Can not write '%s'\n", json_file); }
+}
+
+/* `file' is where the counters are written as JSON at NEMU_END, or NULL. */
+void init_perf(const char *file) {
+  json_file = file;
+}
+
+/* cpu_exec() is timed by these */
+void perf_start() {
+  wall_start = now_ns(CLOCK_MONOTONIC);
+  cpu_start = now_ns(CLOCK_PROCESS_CPUTIME_ID);
+}
+
+void perf_stop() {
+  perf.wall_ns += now_ns(CLOCK_MONOTONIC) - wall_start;
+  perf.cpu_ns += now_ns(CLOCK_PROCESS_CPUTIME_ID) - cpu_start;
+
+  if (nemu_state == NEMU_END && json_file != NULL) { write_json(); }
+}
+
+void perf_print() {
+  printf("instructions  %" PRIu64 "\n", perf.instr);
+  printf("dcache        %" PRIu64 " hits, %" PRIu64 " misses\n", perf.dcache_hit, perf.dcache_miss);
+  printf("TLB misses    %" PRIu64 "\n", perf.tlb_miss);
+  printf("interrupts    %" PRIu64 "\n", perf.intr);
+  printf("host time     %.3f s wall, %.3f s CPU\n", perf.wall_ns / 1e9, perf.cpu_ns / 1e9);
+  printf("speed         %.2f MIPS\n", mips());
+
+  int i;
+  for (i = 0; i < nr_map; i ++) {
+    printf("%-4s %-12s %" PRIu64 " reads, %" PRIu64 " writes\n", maps[i].is_mmio ? "mmio" : "pio",
+        maps[i].name, maps[i].read, maps[i].write);
+  }
+}
+
+void perf_print_mips() {
+  printf("%" PRIu64 " instructions in %.3f s, %.2f MIPS\n", perf.instr, perf.wall_ns / 1e9, mips());
+}
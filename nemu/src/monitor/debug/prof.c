@@ -0,0 +1,293 @@
+#include "nemu.h"
+#include "cpu/decode.h"
+#include "monitor/prof.h"
+#include "monitor/symbol.h"
+#include "device/event.h"
+
+#include <inttypes.h>
+#include <stdlib.h>
+
+bool prof_exact = false;
+
+static const char *folded_file = NULL;
+
+/* Counts by eip, in an open addressing hash table. */
+
+typedef struct {
+  vaddr_t eip;
+  uint64_t count;
+} PCCount;
+
+static PCCount *pc_table = NULL;
+static uint32_t pc_size = 0, nr_pc = 0;
+
+#define PC_EMPTY ((vaddr_t)-1)
+
+static inline uint32_t hash32(uint32_t x) {
+  return (x * 0x9e3779b1u) >> 7;
+}
+
+static void pc_table_init(uint32_t size) {
+  pc_table = malloc(size * sizeof(pc_table[0]));
+  assert(pc_table != NULL);
+  pc_size = size;
+  nr_pc = 0;
+  uint32_t i;
+  for (i = 0; i < size; i ++) {
+    pc_table[i].eip = PC_EMPTY;
+  }
+}
+
+static void pc_table_grow() {
+  PCCount *old = pc_table;
+  uint32_t old_size = pc_size, i;
+  pc_table_init(old_size * 2);
+  for (i = 0; i < old_size; i ++) {
+    if (old[i].eip == PC_EMPTY) { continue; }
+    uint32_t k = hash32(old[i].eip) & (pc_size - 1);
+    while (pc_table[k].eip != PC_EMPTY) { k = (k + 1) & (pc_size - 1); }
+    pc_table[k] = old[i];
+    nr_pc ++;
+  }
+  free(old);
+}
+
+static inline void pc_add(vaddr_t eip) {
+  uint32_t k = hash32(eip) & (pc_size - 1);
+  while (pc_table[k].eip != eip) {
+    if (pc_table[k].eip == PC_EMPTY) {
+      if (nr_pc * 2 >= pc_size) {
+        pc_table_grow();
+        pc_add(eip);
+        return;
+      }
+      pc_table[k].eip = eip;
+      pc_table[k].count = 0;
+      nr_pc ++;
+      break;
+    }
+    k = (k + 1) & (pc_size - 1);
+  }
+  pc_table[k].count ++;
+}
+
+/* Call stacks in the exact mode. A call stack is a node of a tree, whose
+ * children are the functions called from it, identified by their entry.
+ * Calls and returns are recognized by what they do to esp and the stack,
+ * so they work for any call and ret instruction. The shadow stack keeps
+ * the return addresses, so that a longjmp past several frames is followed.
+ */
+
+typedef struct {
+  uint32_t parent;
+  vaddr_t entry;
+  uint64_t count;
+} StackNode;
+
+static StackNode *nodes = NULL;
+static uint32_t nr_node = 0, node_size = 0;
+
+/* children in a hash table keyed by (parent, entry), 0 for empty */
+static uint32_t *child_table = NULL;
+static uint32_t child_size = 0;
+
+#define MAX_DEPTH 1024
+
+static struct {
+  vaddr_t ret_addr;
+  uint32_t node;
+} shadow[MAX_DEPTH];
+static int depth = 0;
+static uint32_t cur_node = 0;
+
+static uint32_t new_node(uint32_t parent, vaddr_t entry) {
+  if (nr_node == node_size) {
+    node_size = (node_size == 0 ? 1024 : node_size * 2);
+    nodes = realloc(nodes, node_size * sizeof(nodes[0]));
+    assert(nodes != NULL);
+  }
+  nodes[nr_node] = (StackNode) { .parent = parent, .entry = entry, .count = 0 };
+  return nr_node ++;
+}
+
+static inline uint32_t child_slot(uint32_t parent, vaddr_t entry) {
+  uint32_t k = hash32(entry ^ (parent * 0x85ebca6bu)) & (child_size - 1);
+  while (child_table[k] != 0 &&
+      (nodes[child_table[k]].parent != parent || nodes[child_table[k]].entry != entry)) {
+    k = (k + 1) & (child_size - 1);
+  }
+  return k;
+}
+
+static uint32_t get_child(uint32_t parent, vaddr_t entry) {
+  if (nr_node * 2 >= child_size) {
+    free(child_table);
+    child_size = (child_size == 0 ? 4096 : child_size * 2);
+    child_table = calloc(child_size, sizeof(child_table[0]));
+    assert(child_table != NULL);
+    uint32_t i;
+    for (i = 1; i < nr_node; i ++) {
+      child_table[child_slot(nodes[i].parent, nodes[i].entry)] = i;
+    }
+  }
+
+  uint32_t k = child_slot(parent, entry);
+  if (child_table[k] == 0) {
+    child_table[k] = new_node(parent, entry);
+  }
+  return child_table[k];
+}
+
+/* Called after the instruction at `eip' is executed, with esp before it. */
+void prof_count(vaddr_t eip, uint32_t esp) {
+  pc_add(eip);
+  nodes[cur_node].count ++;
+
+  vaddr_t next = decoding.seq_eip;
+  if (cpu.eip == next) { return; }
+
+  uint32_t new_esp = reg_l(R_ESP);
+  if (new_esp == esp - 4 && vaddr_read(new_esp, 4) == next) {
+    /* a call */
+    if (depth < MAX_DEPTH) {
+      shadow[depth].ret_addr = next;
+      shadow[depth].node = cur_node;
+      depth ++;
+      cur_node = get_child(cur_node, cpu.eip);
+    }
+  }
+  else if (new_esp > esp && vaddr_read(esp, 4) == cpu.eip) {
+    /* a return, to a frame on the shadow stack if any */
+    int i;
+    for (i = depth - 1; i >= 0 && shadow[i].ret_addr != cpu.eip; i --);
+    if (i >= 0) {
+      cur_node = shadow[i].node;
+      depth = i;
+    }
+  }
+}
+
+static void prof_sample() {
+  pc_add(cpu.eip);
+}
+
+/* Reports. */
+
+typedef struct {
+  const char *name;
+  vaddr_t start;
+  uint64_t count;
+} FuncCount;
+
+static int cmp_count(const void *a, const void *b) {
+  uint64_t x = ((FuncCount *)a)->count, y = ((FuncCount *)b)->count;
+  return x > y ? -1 : x < y;
+}
+
+static int cmp_start(const void *a, const void *b) {
+  vaddr_t x = ((FuncCount *)a)->start, y = ((FuncCount *)b)->start;
+  return x < y ? -1 : x > y;
+}
+
+static const char* func_name(vaddr_t eip, char *buf) {
+  const char *name = symbol_find(eip, NULL);
+  if (name == NULL) {
+    sprintf(buf, "0x%08x", eip);
+    return buf;
+  }
+  return name;
+}
+
+static void write_folded_path(FILE *fp, uint32_t node) {
+  char buf[16];
+  if (nodes[node].parent != node) {
+    write_folded_path(fp, nodes[node].parent);
+    fputc(';', fp);
+  }
+  fputs(func_name(nodes[node].entry, buf), fp);
+}
+
+static void write_folded(FuncCount *funcs, int n) {
+  FILE *fp = fopen(folded_file, "w");
+  if (fp == NULL) {
+    printf("Can not open '%s'\n", folded_file);
+    return;
+  }
+
+  if (prof_exact) {
+    uint32_t i;
+    for (i = 0; i < nr_node; i ++) {
+      if (nodes[i].count == 0) { continue; }
+      write_folded_path(fp, i);
+      fprintf(fp, " %" PRIu64 "\n", nodes[i].count);
+    }
+  }
+  else {
+    /* no call stacks when sampling */
+    int i;
+    for (i = 0; i < n; i ++) {
+      fprintf(fp, "%s %" PRIu64 "\n", funcs[i].name, funcs[i].count);
+    }
+  }
+
+  fclose(fp);
+}
+
+static void prof_report() {
+  /* aggregate the counts by function, unknown code by eip */
+  FuncCount *funcs = malloc((nr_pc + 1) * sizeof(funcs[0]));
+  assert(funcs != NULL);
+  int n = 0, i;
+  uint64_t total = 0;
+  uint32_t k;
+  for (k = 0; k < pc_size; k ++) {
+    if (pc_table[k].eip == PC_EMPTY) { continue; }
+    FuncCount *f = &funcs[n ++];
+    f->start = pc_table[k].eip;
+    f->name = symbol_find(f->start, &f->start);
+    f->count = pc_table[k].count;
+    total += f->count;
+  }
+
+  qsort(funcs, n, sizeof(funcs[0]), cmp_start);
+  int m = 0;
+  for (i = 0; i < n; i ++) {
+    if (m > 0 && funcs[m - 1].start == funcs[i].start) { funcs[m - 1].count += funcs[i].count; }
+    else { funcs[m ++] = funcs[i]; }
+  }
+  n = m;
+  qsort(funcs, n, sizeof(funcs[0]), cmp_count);
+
+  printf("\n# %s: %" PRIu64 "\n", prof_exact ? "Instructions" : "Samples", total);
+  printf("# Overhead  %12s  Symbol\n", prof_exact ? "Instructions" : "Samples");
+  for (i = 0; i < n; i ++) {
+    if (funcs[i].name == NULL) {
+      char buf[16];
+      sprintf(buf, "0x%08x", funcs[i].start);
+      funcs[i].name = strdup(buf);
+    }
+    printf("  %7.2f%%  %12" PRIu64 "  %s\n",
+        total == 0 ? 0.0 : 100.0 * funcs[i].count / total, funcs[i].count, funcs[i].name);
+  }
+
+  if (folded_file != NULL) { write_folded(funcs, n); }
+  free(funcs);
+}
+
+/* `period' is 0 for counting every instruction. `folded' is the file for
+ * the call stacks in the folded format of flamegraph.pl, or NULL.
+ */
+void init_prof(int period, const char *folded) {
+  folded_file = folded;
+  pc_table_init(4096);
+
+  if (period == 0) {
+    prof_exact = true;
+    cur_node = new_node(0, cpu.eip);
+  }
+  else {
+    add_event(prof_sample, EVENT_ICOUNT, period);
+  }
+
+  atexit(prof_report);
+}
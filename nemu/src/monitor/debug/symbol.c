@@ -0,0 +1,140 @@
+#include "monitor/symbol.h"
+
+#include <stdlib.h>
+#include <elf.h>
+
+typedef struct {
+  char *name;
+  vaddr_t addr;
+  uint32_t size;
+  bool is_func;
+} Symbol;
+
+static Symbol *symbols = NULL;
+static int nr_symbol = 0, symbol_size = 0;
+
+/* functions sorted by address, for symbol_find() */
+static Symbol **funcs = NULL;
+static int nr_func = 0;
+
+static void add_symbol(const char *name, int len, vaddr_t addr, uint32_t size, bool is_func) {
+  if (nr_symbol == symbol_size) {
+    symbol_size = (symbol_size == 0 ? 256 : symbol_size * 2);
+    symbols = realloc(symbols, symbol_size * sizeof(symbols[0]));
+    assert(symbols != NULL);
+  }
+  Symbol *s = &symbols[nr_symbol ++];
+  s->name = strndup(name, len);
+  s->addr = addr;
+  s->size = size;
+  s->is_func = is_func;
+}
+
+static int cmp_func(const void *a, const void *b) {
+  vaddr_t x = (*(Symbol **)a)->addr, y = (*(Symbol **)b)->addr;
+  return x < y ? -1 : x > y;
+}
+
+static void sort_funcs() {
+  funcs = realloc(funcs, nr_symbol * sizeof(funcs[0]));
+  assert(nr_symbol == 0 || funcs != NULL);
+  nr_func = 0;
+  int i;
+  for (i = 0; i < nr_symbol; i ++) {
+    if (symbols[i].is_func) { funcs[nr_func ++] = &symbols[i]; }
+  }
+  qsort(funcs, nr_func, sizeof(funcs[0]), cmp_func);
+}
+
+/* Load the function and object symbols of an ELF32 file. */
+bool load_elf_symbols(const char *file) {
+  FILE *fp = fopen(file, "rb");
+  if (fp == NULL) { return false; }
+
+  fseek(fp, 0, SEEK_END);
+  long size = ftell(fp);
+  uint8_t *buf = malloc(size);
+  assert(buf != NULL);
+  rewind(fp);
+  bool ok = (fread(buf, size, 1, fp) == 1);
+  fclose(fp);
+
+  Elf32_Ehdr *eh = (void *)buf;
+  ok = ok && size >= sizeof(*eh) && memcmp(eh->e_ident, ELFMAG, SELFMAG) == 0 &&
+    eh->e_ident[EI_CLASS] == ELFCLASS32 && eh->e_shentsize == sizeof(Elf32_Shdr) &&
+    eh->e_shoff + (long)eh->e_shnum * sizeof(Elf32_Shdr) <= size;
+  if (!ok) {
+    free(buf);
+    return false;
+  }
+
+  Elf32_Shdr *sh = (void *)(buf + eh->e_shoff);
+  int i, j;
+  for (i = 0; i < eh->e_shnum; i ++) {
+    if (sh[i].sh_type != SHT_SYMTAB || sh[i].sh_link >= eh->e_shnum) { continue; }
+
+    Elf32_Shdr *strtab = &sh[sh[i].sh_link];
+    if (sh[i].sh_offset + (long)sh[i].sh_size > size ||
+        strtab->sh_offset + (long)strtab->sh_size > size) { continue; }
+
+    Elf32_Sym *sym = (void *)(buf + sh[i].sh_offset);
+    int n = sh[i].sh_size / sizeof(Elf32_Sym);
+    for (j = 0; j < n; j ++) {
+      int type = ELF32_ST_TYPE(sym[j].st_info);
+      if ((type != STT_FUNC && type != STT_OBJECT) || sym[j].st_name >= strtab->sh_size) { continue; }
+
+      const char *name = (char *)buf + strtab->sh_offset + sym[j].st_name;
+      add_symbol(name, strtab->sh_size - sym[j].st_name, sym[j].st_value, sym[j].st_size, type == STT_FUNC);
+    }
+  }
+
+  free(buf);
+  sort_funcs();
+  return true;
+}
+
+/* Load the functions from lines like `00100000 <_start>:'. */
+bool load_objdump_symbols(const char *file) {
+  FILE *fp = fopen(file, "r");
+  if (fp == NULL) { return false; }
+
+  char line[512], name[256];
+  vaddr_t addr;
+  while (fgets(line, sizeof(line), fp) != NULL) {
+    if (sscanf(line, "%x <%255[^>]>:", &addr, name) == 2) {
+      add_symbol(name, strlen(name), addr, 0, true);
+    }
+  }
+
+  fclose(fp);
+  sort_funcs();
+  return true;
+}
+
+bool symbol_lookup(const char *name, vaddr_t *addr) {
+  int i;
+  for (i = 0; i < nr_symbol; i ++) {
+    if (strcmp(symbols[i].name, name) == 0) {
+      *addr = symbols[i].addr;
+      return true;
+    }
+  }
+  return false;
+}
+
+/* Return the name of the function containing `addr', with its start. */
+const char* symbol_find(vaddr_t addr, vaddr_t *start) {
+  int l = 0, r = nr_func;
+  while (l < r) {
+    int m = (l + r) / 2;
+    if (funcs[m]->addr <= addr) { l = m + 1; }
+    else { r = m; }
+  }
+  if (l == 0) { return NULL; }
+
+  /* functions without a size extend to the next one */
+  Symbol *f = funcs[l - 1];
+  if (f->size != 0 && addr >= f->addr + f->size) { return NULL; }
+  if (start != NULL) { *start = f->addr; }
+  return f->name;
+}
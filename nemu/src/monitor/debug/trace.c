@@ -0,0 +1,102 @@
+#include "common.h"
+#include "monitor/trace.h"
+
+#include <pthread.h>
+#include <stdlib.h>
+
+/* Records are put into a ring of chunks. A chunk is handed to the writer
+ * thread when it is full, so the execution loop never waits for I/O unless
+ * the whole ring is waiting to be written.
+ */
+
+#define TRACE_CHUNK 4096
+#define NR_TRACE_CHUNK 16
+
+int trace_enabled = false;
+
+static FILE *trace_fp = NULL;
+static TraceRecord ring[NR_TRACE_CHUNK][TRACE_CHUNK];
+static int chunk_len[NR_TRACE_CHUNK];
+static int cur_chunk = 0, cur_idx = 0;   // owned by the producer
+static int nr_ready = 0, ready_head = 0; // protected by `lock'
+static bool trace_done = false;
+
+static pthread_t writer;
+static pthread_mutex_t lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t cond_ready = PTHREAD_COND_INITIALIZER;
+static pthread_cond_t cond_free = PTHREAD_COND_INITIALIZER;
+
+static void* trace_writer(void *arg) {
+  pthread_mutex_lock(&lock);
+  while (true) {
+    while (nr_ready == 0 && !trace_done) {
+      pthread_cond_wait(&cond_ready, &lock);
+    }
+    if (nr_ready == 0) { break; }
+
+    int i = ready_head;
+    pthread_mutex_unlock(&lock);
+    fwrite(ring[i], sizeof(TraceRecord), chunk_len[i], trace_fp);
+    pthread_mutex_lock(&lock);
+
+    ready_head = (ready_head + 1) % NR_TRACE_CHUNK;
+    nr_ready --;
+    pthread_cond_signal(&cond_free);
+  }
+  pthread_mutex_unlock(&lock);
+  return NULL;
+}
+
+/* hand the current chunk to the writer thread */
+static void trace_submit() {
+  pthread_mutex_lock(&lock);
+  chunk_len[cur_chunk] = cur_idx;
+  nr_ready ++;
+  pthread_cond_signal(&cond_ready);
+  while (nr_ready == NR_TRACE_CHUNK) {
+    pthread_cond_wait(&cond_free, &lock);
+  }
+  pthread_mutex_unlock(&lock);
+
+  cur_chunk = (cur_chunk + 1) % NR_TRACE_CHUNK;
+  cur_idx = 0;
+}
+
+void trace_write(uint32_t eip, int len, const uint8_t *instr) {
+  TraceRecord *r = &ring[cur_chunk][cur_idx];
+  r->eip = eip;
+  r->len = len;
+  memcpy(r->instr, instr, len < TRACE_INSTR_MAX ? len : TRACE_INSTR_MAX);
+
+  if (++ cur_idx == TRACE_CHUNK) {
+    trace_submit();
+  }
+}
+
+static void trace_close() {
+  if (cur_idx > 0) {
+    trace_submit();
+  }
+
+  pthread_mutex_lock(&lock);
+  trace_done = true;
+  pthread_cond_signal(&cond_ready);
+  pthread_mutex_unlock(&lock);
+
+  pthread_join(writer, NULL);
+  fclose(trace_fp);
+}
+
+void init_trace(const char *file) {
+  trace_fp = fopen(file, "wb");
+  Assert(trace_fp, "Can not open '%s'", file);
+
+  TraceHeader h = { .magic = TRACE_MAGIC, .version = TRACE_VERSION };
+  fwrite(&h, sizeof(h), 1, trace_fp);
+
+  int ret = pthread_create(&writer, NULL, trace_writer, NULL);
+  Assert(ret == 0, "Can not create the trace writer thread");
+  atexit(trace_close);
+
+  trace_enabled = true;
+}
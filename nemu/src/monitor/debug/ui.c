@@ -1,6 +1,8 @@
 #include "monitor/monitor.h"
 #include "monitor/expr.h"
 #include "monitor/watchpoint.h"
+#include "monitor/snapshot.h"
+#include "monitor/perf.h"
 #include "nemu.h"
 
 #include <stdlib.h>
@@ -36,6 +38,69 @@ static int cmd_q(char *args) {
   return -1;
 }
 
+static int cmd_save(char *args) {
+  char *file = strtok(NULL, " ");
+  if (file == NULL) { printf("Usage: save FILE\n"); return 0; }
+  snapshot_save(file);
+  return 0;
+}
+
+static int cmd_load(char *args) {
+  char *file = strtok(NULL, " ");
+  if (file == NULL) { printf("Usage: load FILE\n"); return 0; }
+  snapshot_load(file);
+  return 0;
+}
+
+static int cmd_screenshot(char *args) {
+  char *file = strtok(NULL, " ");
+  if (file == NULL) { printf("Usage: screenshot FILE\n"); return 0; }
+#ifdef HAS_IOE
+  bool vga_dump(const char *);
+  vga_dump(file);
+#else
+  printf("There is no screen without HAS_IOE\n");
+#endif
+  return 0;
+}
+
+static int cmd_info(char *args) {
+  char *sub = strtok(NULL, " ");
+  if (sub != NULL && strcmp(sub, "w") == 0) {
+    list_watchpoints();
+  }
+  else if (sub != NULL && strcmp(sub, "perf") == 0) {
+    perf_print();
+  }
+  else {
+    printf("Usage: info w|perf\n");
+  }
+  return 0;
+}
+
+static int cmd_p(char *args) {
+  if (args == NULL) { printf("Usage: p EXPR\n"); return 0; }
+  bool success;
+  uint32_t val = expr(args, &success);
+  if (success) { printf("%u\t0x%08x\n", val, val); }
+  else { printf("Invalid expression '%s'\n", args); }
+  return 0;
+}
+
+static int cmd_w(char *args) {
+  if (args == NULL) { printf("Usage: w EXPR | w *ADDR\n"); return 0; }
+  int NO = set_watchpoint(args);
+  if (NO >= 0) { printf("Watchpoint %d: %s\n", NO, args); }
+  return 0;
+}
+
+static int cmd_d(char *args) {
+  char *arg = strtok(NULL, " ");
+  if (arg == NULL) { printf("Usage: d N\n"); return 0; }
+  if (!delete_watchpoint(atoi(arg))) { printf("No watchpoint number %s\n", arg); }
+  return 0;
+}
+
 static int cmd_help(char *args);
 
 static struct {
@@ -46,6 +111,13 @@ static struct {
   { "help", "Display informations about all supported commands", cmd_help },
   { "c", "Continue the execution of the program", cmd_c },
   { "q", "Exit NEMU", cmd_q },
+  { "save", "Save a snapshot of the machine to a file", cmd_save },
+  { "load", "Restore the machine from a snapshot file", cmd_load },
+  { "screenshot", "Write the screen to FILE, as PPM if it ends with `.ppm' and raw ARGB otherwise", cmd_screenshot },
+  { "info", "Print the watchpoints with `info w', or the counters of NEMU with `info perf'", cmd_info },
+  { "p", "Print the value of EXPR, with registers like $eax, `*' for memory and symbols for their addresses", cmd_p },
+  { "w", "Stop when the value of EXPR changes, or the 4 bytes at ADDR with `w *ADDR'", cmd_w },
+  { "d", "Delete watchpoint N", cmd_d },
 
   /* TODO: Add more commands */
 
@@ -79,6 +151,7 @@ static int cmd_help(char *args) {
 void ui_mainloop(int is_batch_mode) {
   if (is_batch_mode) {
     cmd_c(NULL);
+    perf_print_mips();
     return;
   }
 
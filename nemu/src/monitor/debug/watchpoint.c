@@ -1,11 +1,19 @@
+#include "nemu.h"
+#include "monitor/monitor.h"
 #include "monitor/watchpoint.h"
 #include "monitor/expr.h"
+#include "memory/mmu.h"
+
+#include <stdlib.h>
 
 #define NR_WP 32
 
 static WP wp_pool[NR_WP];
 static WP *head, *free_;
 
+int nr_watch_mem = 0;
+int nr_watch_expr = 0;
+
 void init_wp_pool() {
   int i;
   for (i = 0; i < NR_WP; i ++) {
@@ -18,6 +26,159 @@ void init_wp_pool() {
   free_ = wp_pool;
 }
 
-/* TODO: Implement the functionality of watchpoint */
+static WP* new_wp() {
+  assert(free_ != NULL);
+  WP *wp = free_;
+  free_ = free_->next;
+  wp->next = head;
+  head = wp;
+  return wp;
+}
+
+static void free_wp(WP *wp) {
+  WP **p;
+  for (p = &head; *p != wp; p = &(*p)->next) {
+    assert(*p != NULL);
+  }
+  *p = wp->next;
+  wp->next = free_;
+  free_ = wp;
+}
+
+/* Whether a write to the virtual page of `addr' may hit a memory watchpoint. */
+bool watch_page(vaddr_t addr) {
+  WP *wp;
+  for (wp = head; wp != NULL; wp = wp->next) {
+    if (wp->is_mem && (((wp->addr ^ addr) & ~PAGE_MASK) == 0 ||
+          (((wp->addr + 3) ^ addr) & ~PAGE_MASK) == 0)) {
+      return true;
+    }
+  }
+  return false;
+}
+
+/* Called before [addr, addr + len) is written with `data'. The program
+ * stops after the instruction if a watched value is changed.
+ */
+void watch_write(vaddr_t addr, int len, uint32_t data) {
+  WP *wp;
+  for (wp = head; wp != NULL; wp = wp->next) {
+    if (!wp->is_mem || addr >= wp->addr + 4 || addr + len <= wp->addr) { continue; }
+
+    uint32_t new_val = wp->old_val;
+    int i;
+    for (i = 0; i < len; i ++) {
+      int k = addr + i - wp->addr;
+      if (k >= 0 && k < 4) {
+        new_val = (new_val & ~(0xffu << (k * 8))) | (((data >> (i * 8)) & 0xff) << (k * 8));
+      }
+    }
+
+    if (new_val != wp->old_val) {
+      printf("Watchpoint %d: %s\nOld value = 0x%08x\nNew value = 0x%08x\n",
+          wp->NO, wp->expr, wp->old_val, new_val);
+      wp->old_val = new_val;
+      if (nemu_state == NEMU_RUNNING) { nemu_state = NEMU_STOP; }
+    }
+  }
+}
+
+/* Evaluate the expression watchpoints, return whether one is changed. */
+bool check_watch_expr() {
+  bool hit = false;
+  WP *wp;
+  for (wp = head; wp != NULL; wp = wp->next) {
+    if (wp->is_mem) { continue; }
+
+    bool success;
+    uint32_t val = expr_eval(wp->code, &success);
+    if (success && val != wp->old_val) {
+      printf("Watchpoint %d: %s\nOld value = 0x%08x\nNew value = 0x%08x\n",
+          wp->NO, wp->expr, wp->old_val, val);
+      wp->old_val = val;
+      hit = true;
+    }
+  }
+  return hit;
+}
+
+/* `*ADDR' watches the 4 bytes at ADDR, which is evaluated only once.
+ * Other expressions are compiled once and evaluated by the bytecode.
+ */
+int set_watchpoint(char *e) {
+  if (free_ == NULL) {
+    printf("Too many watchpoints\n");
+    return -1;
+  }
+  if (strlen(e) >= WP_EXPR_LEN) {
+    printf("The expression is too long\n");
+    return -1;
+  }
+
+  bool success = true;
+  bool is_mem = (e[0] == '*');
+  Expr *code = NULL;
+  uint32_t val;
+  if (is_mem) {
+    val = expr(e + 1, &success);
+  }
+  else {
+#ifndef DEBUG
+    printf("Only memory watchpoints are supported without DEBUG\n");
+    return -1;
+#endif
+    code = expr_compile(e);
+    success = (code != NULL);
+    if (success) { val = expr_eval(code, &success); }
+  }
+  if (!success) {
+    printf("Invalid expression '%s'\n", e);
+    expr_free(code);
+    return -1;
+  }
+
+  WP *wp = new_wp();
+  strcpy(wp->expr, e);
+  wp->is_mem = is_mem;
+  wp->code = code;
+  if (is_mem) {
+    wp->addr = val;
+    wp->old_val = vaddr_read(val, 4);
+    nr_watch_mem ++;
+    /* drop the write permission of the page cached by the TLB */
+    tlb_flush();
+  }
+  else {
+    wp->old_val = val;
+    nr_watch_expr ++;
+  }
+  return wp->NO;
+}
+
+bool delete_watchpoint(int NO) {
+  if (NO < 0 || NO >= NR_WP) { return false; }
 
+  WP *wp;
+  for (wp = head; wp != NULL && wp != &wp_pool[NO]; wp = wp->next);
+  if (wp == NULL) { return false; }
+
+  if (wp->is_mem) { nr_watch_mem --; }
+  else { nr_watch_expr --; }
+  expr_free(wp->code);
+  wp->code = NULL;
+  free_wp(wp);
+  return true;
+}
 
+void list_watchpoints() {
+  if (head == NULL) {
+    printf("No watchpoints\n");
+    return;
+  }
+
+  printf("Num     Value       What\n");
+  WP *wp;
+  for (wp = head; wp != NULL; wp = wp->next) {
+    printf("%-8d0x%08x  %s\n", wp->NO, wp->old_val, wp->expr);
+  }
+}
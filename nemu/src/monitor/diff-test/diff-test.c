@@ -1,11 +1,22 @@
+#include "common.h"
+
+#ifdef DIFF_TEST
+
 #include "nemu.h"
+#include "cpu/rtl.h"
 #include "monitor/monitor.h"
+#include "cpu/decode-cache.h"
+#include "cpu/tb.h"
+#include "device/event.h"
+#include <inttypes.h>
 #include <unistd.h>
 #include <sys/prctl.h>
 #include <signal.h>
 
 #include "protocol.h"
+#include "ref.h"
 #include <stdlib.h>
+#include <dlfcn.h>
 
 bool gdb_connect_qemu(void);
 bool gdb_memcpy_to_qemu(uint32_t, void *, int);
@@ -13,25 +24,30 @@ bool gdb_getregs(union gdb_regs *);
 bool gdb_setregs(union gdb_regs *);
 bool gdb_si(void);
 void gdb_exit(void);
+void exec_wrapper(bool);
 
+/* The instruction is not executed by the reference model, whose
+ * registers are set to those of NEMU instead.
+ */
 static bool is_skip_qemu;
+/* QEMU is not stepped for the instruction, see difftest_step(). */
 static bool is_skip_nemu;
 
 void diff_test_skip_qemu() { is_skip_qemu = true; }
 void diff_test_skip_nemu() { is_skip_nemu = true; }
 
-#define regcpy_from_nemu(regs) \
-  do { \
-    regs.eax = cpu.eax; \
-    regs.ecx = cpu.ecx; \
-    regs.edx = cpu.edx; \
-    regs.ebx = cpu.ebx; \
-    regs.esp = cpu.esp; \
-    regs.ebp = cpu.ebp; \
-    regs.esi = cpu.esi; \
-    regs.edi = cpu.edi; \
-    regs.eip = cpu.eip; \
-  } while (0)
+/* the flags maintained by NEMU: CF, ZF, SF and OF */
+#define EFLAGS_MASK 0x8c1
+
+static void regcpy_from_nemu(DiffRegs *regs) {
+  eflags_materialize();
+  regs->eflags = (regs->eflags & ~EFLAGS_MASK) | (cpu.eflags.val & EFLAGS_MASK);
+  int i;
+  for (i = R_EAX; i <= R_EDI; i ++) {
+    regs->gpr[i] = reg_l(i);
+  }
+  regs->eip = cpu.eip;
+}
 
 static uint8_t mbr[] = {
   // start16:
@@ -63,7 +79,7 @@ static uint8_t mbr[] = {
   0x17, 0x00, 0x2c, 0x7c, 0x00, 0x00
 };
 
-void init_difftest(void) {
+static void qemu_init() {
   int ppid_before_fork = getpid();
   int pid = fork();
   if (pid == -1) {
@@ -118,40 +134,320 @@ void init_difftest(void) {
   }
 }
 
-void init_qemu_reg() {
+static void qemu_memcpy(paddr_t dest, void *src, int len) {
+  bool ok = gdb_memcpy_to_qemu(dest, src, len);
+  assert(ok == 1);
+}
+
+static void qemu_getregs(DiffRegs *regs) {
+  union gdb_regs r;
+  gdb_getregs(&r);
+  memcpy(regs->gpr, r.array, sizeof(regs->gpr));
+  regs->eip = r.eip;
+  regs->eflags = r.eflags;
+}
+
+static void qemu_setregs(DiffRegs *regs) {
   union gdb_regs r;
   gdb_getregs(&r);
-  regcpy_from_nemu(r);
+  memcpy(r.array, regs->gpr, sizeof(regs->gpr));
+  r.eip = regs->eip;
+  r.eflags = regs->eflags;
   bool ok = gdb_setregs(&r);
   assert(ok == 1);
 }
 
-void difftest_step(uint32_t eip) {
-  union gdb_regs r;
+static void qemu_exec(uint64_t n) {
+  while (n --) {
+    gdb_si();
+  }
+}
+
+/* QEMU can not hash the stores or rewind, see ref.h */
+static DiffRef qemu_ref = {
+  "qemu", qemu_init, qemu_memcpy, qemu_getregs, qemu_setregs, qemu_exec
+};
+
+/* a reference model in a shared library, see ref.h */
+static DiffRef so_ref;
+
+static void load_ref_so(const char *file) {
+  /* the library may well be another NEMU, keep its symbols to itself */
+  void *handle = dlopen(file, RTLD_NOW | RTLD_LOCAL | RTLD_DEEPBIND);
+  Assert(handle != NULL, "Can not load the reference model: %s", dlerror());
+
+#define load_ref_func(f) \
+  so_ref.f = dlsym(handle, DIFF_REF_PREFIX #f); \
+  Assert(so_ref.f != NULL, "'%s' does not export %s", file, DIFF_REF_PREFIX #f);
+
+  load_ref_func(init);
+  load_ref_func(memcpy);
+  load_ref_func(getregs);
+  load_ref_func(setregs);
+  load_ref_func(exec);
+#undef load_ref_func
+
+  /* optional */
+  so_ref.memhash = dlsym(handle, DIFF_REF_PREFIX "memhash");
+  so_ref.checkpoint = dlsym(handle, DIFF_REF_PREFIX "checkpoint");
+  so_ref.rewind = dlsym(handle, DIFF_REF_PREFIX "rewind");
+  if (so_ref.checkpoint == NULL || so_ref.rewind == NULL) {
+    so_ref.checkpoint = so_ref.rewind = NULL;
+  }
+
+  so_ref.name = file;
+}
+
+static DiffRef *ref = NULL;
+
+/* Batched checking, enabled by --diff-batch. The reference model is
+ * stepped and checked once every `difftest_batch' instructions, and the
+ * sums of hashes of the stores since the last check are compared along
+ * with the registers. Both sides save a checkpoint after each check, so
+ * that a divergence can be bisected down to the first differing
+ * instruction if the reference model can rewind.
+ */
+static int difftest_batch = 0;
+
+/* instructions executed by NEMU but not by the reference model yet */
+static uint64_t nr_pending = 0;
+/* the registers before the last instruction */
+static CPU_state cpu_before;
+static CPU_state cpu_checkpoint;
+static uint64_t hash_checkpoint, ref_hash_checkpoint;
+static uint64_t icount_checkpoint;
+/* instructions are executed by bisect() itself */
+static bool bisecting = false;
+
+/* `file' is a shared library of a reference model, or NULL for QEMU.
+ * `batch' is the number of instructions checked at once.
+ */
+void init_difftest(const char *file, int batch) {
+  if (file == NULL || strcmp(file, "qemu") == 0) {
+    ref = &qemu_ref;
+  }
+  else {
+    load_ref_so(file);
+    ref = &so_ref;
+  }
+
+  ref->init();
+  Log("Differential testing against %s", ref->name);
+
+  difftest_batch = batch;
+  if (difftest_batch > 0) {
+    Log("Checking every %d instructions%s%s", difftest_batch,
+        ref->memhash != NULL ? ", with the stores" : "",
+        ref->rewind != NULL ? ", bisecting divergences" : "");
+  }
+}
+
+void difftest_memcpy_to_ref(paddr_t dest, void *src, int len) {
+  ref->memcpy(dest, src, len);
+}
+
+static void checkpoint() {
+  nr_pending = 0;
+  cpu_checkpoint = cpu_before = cpu;
+  hash_checkpoint = mem_write_hash;
+  icount_checkpoint = icount_now();
+  mem_checkpoint();
+
+  if (ref->memhash != NULL) { ref_hash_checkpoint = ref->memhash(); }
+  if (ref->checkpoint != NULL) { ref->checkpoint(); }
+}
+
+static void rewind_both() {
+  mem_rewind();
+  cpu = cpu_checkpoint;
+  mem_write_hash = hash_checkpoint;
+  icount_adjust(icount_checkpoint - icount_now());
+  ref->rewind();
+
+  tlb_flush();
+  dcache_flush();
+  tb_flush();
+}
+
+/* Set the registers of the reference model to those of NEMU. */
+void difftest_sync_reg() {
+  DiffRegs r;
+  ref->getregs(&r);
+  regcpy_from_nemu(&r);
+  ref->setregs(&r);
+
+  if (difftest_batch > 0) { checkpoint(); }
+}
+
+/* Check the registers state with the reference model, and the stores
+ * since the checkpoint in batched checking. Differences are reported
+ * if `where' is not NULL, which describes the instructions checked.
+ */
+static bool difftest_check(const char *where) {
+  DiffRegs r;
   bool diff = false;
+  ref->getregs(&r);
+
+#define check_reg(name, nemu_val, qemu_val) \
+  if ((nemu_val) != (qemu_val)) { \
+    if (where != NULL) { \
+      printf("%s is different %s, right = 0x%08x, wrong = 0x%08x\n", \
+          name, where, qemu_val, nemu_val); \
+    } \
+    diff = true; \
+  }
+
+  int i;
+  for (i = R_EAX; i <= R_EDI; i ++) {
+    check_reg(regsl[i], reg_l(i), r.gpr[i]);
+  }
+  check_reg("eip", cpu.eip, r.eip);
+
+  eflags_materialize();
+  check_reg("eflags", cpu.eflags.val & EFLAGS_MASK, r.eflags & EFLAGS_MASK);
+#undef check_reg
+
+  if (difftest_batch > 0 && ref->memhash != NULL &&
+      mem_write_hash - hash_checkpoint != ref->memhash() - ref_hash_checkpoint) {
+    if (where != NULL) { printf("memory stores are different %s\n", where); }
+    diff = true;
+  }
+
+  return !diff;
+}
+
+static void run_both(uint64_t n) {
+  ref->exec(n);
+  while (n --) {
+    exec_wrapper(false);
+    icount_adjust(1);
+  }
+}
+
+/* Both sides agree at the checkpoint but not after `n' instructions. */
+static void bisect(uint64_t n) {
+  uint64_t good = 0;
+
+  bisecting = true;
+  while (n > 1) {
+    uint64_t half = n / 2;
+    rewind_both();
+    run_both(half);
+    if (difftest_check(NULL)) {
+      checkpoint();
+      good += half;
+      n -= half;
+    }
+    else {
+      n = half;
+    }
+  }
+
+  rewind_both();
+  uint32_t eip = cpu.eip;
+  run_both(1);
+  bisecting = false;
+
+  char where[64];
+  snprintf(where, sizeof(where), "after executing instruction at eip = 0x%08x", eip);
+  printf("Bisected to the instruction %" PRIu64 " after the last check, "
+      "instruction %" PRIu64 " of the run\n", good, icount_now());
+  if (difftest_check(where)) {
+    printf("but they agree after it, is the guest program deterministic?\n");
+  }
+}
+
+/* Step the reference model for the pending instructions and check. */
+static bool batch_check() {
+  if (nr_pending == 0) { return true; }
+
+  ref->exec(nr_pending);
+  if (difftest_check(NULL)) { return true; }
 
+  if (ref->rewind != NULL) {
+    bisect(nr_pending);
+  }
+  else {
+    char where[64];
+    snprintf(where, sizeof(where), "within the last %" PRIu64 " instructions", nr_pending);
+    difftest_check(where);
+  }
+  return false;
+}
+
+static void difftest_step_batch() {
   if (is_skip_nemu) {
     is_skip_nemu = false;
-    return;
+    if (ref == &qemu_ref) {
+      cpu_before = cpu;
+      return;
+    }
   }
 
   if (is_skip_qemu) {
-    // to skip the checking of an instruction, just copy the reg state to qemu
-    gdb_getregs(&r);
-    regcpy_from_nemu(r);
-    gdb_setregs(&r);
     is_skip_qemu = false;
+    /* the reference model stops before this instruction */
+    CPU_state now = cpu;
+    cpu = cpu_before;
+    if (!batch_check()) {
+      nemu_state = NEMU_END;
+      return;
+    }
+    cpu = now;
+    difftest_sync_reg();
+  }
+  else if (++ nr_pending == difftest_batch) {
+    if (!batch_check()) {
+      nemu_state = NEMU_END;
+      return;
+    }
+    checkpoint();
+  }
+
+  cpu_before = cpu;
+}
+
+/* Check the instructions of an unfinished batch, when NEMU stops. */
+void difftest_flush() {
+  if (difftest_batch == 0 || nemu_state == NEMU_END) { return; }
+
+  if (!batch_check()) {
+    nemu_state = NEMU_END;
     return;
   }
+  checkpoint();
+}
 
-  gdb_si();
-  gdb_getregs(&r);
+void difftest_step(uint32_t eip) {
+  if (difftest_batch > 0) {
+    if (bisecting) { return; }
+    /* the instruction is executed, but not counted by icount_now() yet */
+    icount_adjust(1);
+    difftest_step_batch();
+    icount_adjust(-1);
+    return;
+  }
 
-  // TODO: Check the registers state with QEMU.
-  // Set `diff` as `true` if they are not the same.
-  TODO();
+  if (is_skip_nemu) {
+    is_skip_nemu = false;
+    /* QEMU executes `int' together with the next instruction in one step */
+    if (ref == &qemu_ref) { return; }
+  }
 
-  if (diff) {
+  if (is_skip_qemu) {
+    // to skip the checking of an instruction, just copy the reg state to the reference
+    difftest_sync_reg();
+    is_skip_qemu = false;
+    return;
+  }
+
+  ref->exec(1);
+
+  char where[64];
+  snprintf(where, sizeof(where), "after executing instruction at eip = 0x%08x", eip);
+  if (!difftest_check(where)) {
     nemu_state = NEMU_END;
   }
 }
+
+#endif
@@ -5,46 +5,90 @@
 
 static struct gdb_conn *conn;
 
+/* Packets are built here. QEMU accepts packets of up to 4096 bytes. */
+#define GDB_PACKET_SIZE 4096
+static char buf[GDB_PACKET_SIZE];
+
+/* whether QEMU accepts binary `X' packets */
+static bool has_x_packet;
+
+static const char hex_digits[] = "0123456789abcdef";
+
+static int hex_encode_buf(char *p, const void *src, int len) {
+  int i;
+  for (i = 0; i < len; i ++) {
+    uint8_t b = ((const uint8_t *)src)[i];
+    p[i * 2] = hex_digits[b >> 4];
+    p[i * 2 + 1] = hex_digits[b & 0xf];
+  }
+  return len * 2;
+}
+
+static bool gdb_request_ok(int len) {
+  gdb_send(conn, (const uint8_t *)buf, len);
+
+  size_t size;
+  uint8_t *reply = gdb_recv(conn, &size);
+  return !strcmp((const char*)reply, "OK");
+}
+
 bool gdb_connect_qemu(void) {
   // connect to gdbserver on localhost port 1234
   while ((conn = gdb_begin_inet("127.0.0.1", 1234)) == NULL) {
     usleep(1);
   }
 
+  // neither side acknowledges packets on TCP
+  gdb_start_noack(conn);
+
+  // an empty `X' packet is answered with OK if it is supported, as gdb probes it
+  has_x_packet = gdb_request_ok(sprintf(buf, "X0,0:"));
+
   return true;
 }
 
-static bool gdb_memcpy_to_qemu_small(uint32_t dest, void *src, int len) {
-  char *buf = malloc(len * 2 + 128);
-  assert(buf != NULL);
-  int p = sprintf(buf, "M0x%x,%x:", dest, len);
-  int i;
-  for (i = 0; i < len; i ++) {
-    p += sprintf(buf + p, "%c%c", hex_encode(((uint8_t *)src)[i] >> 4), hex_encode(((uint8_t *)src)[i] & 0xf));
+/* Send as much of [src, src + len) as fits in one packet,
+ * returning the number of bytes sent, or -1 on failure.
+ */
+static int gdb_memcpy_to_qemu_small(uint32_t dest, const uint8_t *src, int len) {
+  /* leave space for the header */
+  const int limit = GDB_PACKET_SIZE - 32;
+  int n, p;
+
+  if (has_x_packet) {
+    /* binary data, escaping the characters of the framing */
+    static char data[GDB_PACKET_SIZE];
+    int d = 0;
+    for (n = 0; n < len && d < limit - 1; n ++) {
+      uint8_t c = src[n];
+      if (c == '$' || c == '#' || c == '}' || c == '*') {
+        data[d ++] = '}';
+        c ^= 0x20;
+      }
+      data[d ++] = c;
+    }
+    p = sprintf(buf, "X%x,%x:", dest, n);
+    memcpy(buf + p, data, d);
+    p += d;
+  }
+  else {
+    n = (len < limit / 2 ? len : limit / 2);
+    p = sprintf(buf, "M%x,%x:", dest, n);
+    p += hex_encode_buf(buf + p, src, n);
   }
 
-  gdb_send(conn, (const uint8_t *)buf, strlen(buf));
-  free(buf);
-
-  size_t size;
-  uint8_t *reply = gdb_recv(conn, &size);
-  bool ok = !strcmp((const char*)reply, "OK");
-  free(reply);
-
-  return ok;
+  return gdb_request_ok(p) ? n : -1;
 }
 
 bool gdb_memcpy_to_qemu(uint32_t dest, void *src, int len) {
-  const int mtu = 1500;
-  bool ok = true;
-  while (len > mtu) {
-    ok &= gdb_memcpy_to_qemu_small(dest, src, mtu);
-    dest += mtu;
-    src += mtu;
-    len -= mtu;
+  while (len > 0) {
+    int n = gdb_memcpy_to_qemu_small(dest, src, len);
+    if (n < 0) { return false; }
+    dest += n;
+    src += n;
+    len -= n;
   }
-  ok &= gdb_memcpy_to_qemu_small(dest, src, len);
-  return ok;
+  return true;
 }
 
 bool gdb_getregs(union gdb_regs *r) {
@@ -52,52 +96,27 @@ bool gdb_getregs(union gdb_regs *r) {
   size_t size;
   uint8_t *reply = gdb_recv(conn, &size);
 
+  /* registers are sent in target byte order, byte by byte */
+  uint8_t *dest = (uint8_t *)r;
   int i;
-  uint8_t *p = reply;
-  uint8_t c;
-  for (i = 0; i < sizeof(union gdb_regs) / sizeof(uint32_t); i ++) {
-    c = p[8];
-    p[8] = '\0';
-    r->array[i] = gdb_decode_hex_str(p);
-    p[8] = c;
-    p += 8;
+  for (i = 0; i < sizeof(union gdb_regs) && i * 2 + 1 < size; i ++) {
+    dest[i] = gdb_decode_hex(reply[i * 2], reply[i * 2 + 1]);
   }
 
-  free(reply);
-
   return true;
 }
 
 bool gdb_setregs(union gdb_regs *r) {
-  int len = sizeof(union gdb_regs);
-  char *buf = malloc(len * 2 + 128);
-  assert(buf != NULL);
   buf[0] = 'G';
-
-  void *src = r;
-  int p = 1;
-  int i;
-  for (i = 0; i < len; i ++) {
-    p += sprintf(buf + p, "%c%c", hex_encode(((uint8_t *)src)[i] >> 4), hex_encode(((uint8_t *)src)[i] & 0xf));
-  }
-
-  gdb_send(conn, (const uint8_t *)buf, strlen(buf));
-  free(buf);
-
-  size_t size;
-  uint8_t *reply = gdb_recv(conn, &size);
-  bool ok = !strcmp((const char*)reply, "OK");
-  free(reply);
-
-  return ok;
+  int p = 1 + hex_encode_buf(buf + 1, r, sizeof(union gdb_regs));
+  return gdb_request_ok(p);
 }
 
 bool gdb_si(void) {
-  char buf[] = "vCont;s:1";
-  gdb_send(conn, (const uint8_t *)buf, strlen(buf));
+  static const char cmd[] = "vCont;s:1";
+  gdb_send(conn, (const uint8_t *)cmd, sizeof(cmd) - 1);
   size_t size;
-  uint8_t *reply = gdb_recv(conn, &size);
-  free(reply);
+  gdb_recv(conn, &size);
   return true;
 }
 
@@ -42,6 +42,9 @@ struct gdb_conn {
   FILE *in;
   FILE *out;
   bool ack;
+  // the buffer of replies, reused by every packet
+  uint8_t *reply;
+  size_t reply_size;
 };
 
 
@@ -73,7 +76,7 @@ uint64_t gdb_decode_hex_str(uint8_t *bytes) {
 
 
 static struct gdb_conn* gdb_begin(int fd) {
-  struct gdb_conn *conn = calloc(1, sizeof(struct gdb_conn *));
+  struct gdb_conn *conn = calloc(1, sizeof(struct gdb_conn));
   if (conn == NULL)
     err(1, "calloc");
 
@@ -141,6 +144,7 @@ struct gdb_conn* gdb_begin_inet(const char *addr, uint16_t port) {
 void gdb_end(struct gdb_conn *conn) {
   fclose(conn->in);
   fclose(conn->out);
+  free(conn->reply);
   free(conn);
 }
 
@@ -179,12 +183,17 @@ void gdb_send(struct gdb_conn *conn, const uint8_t *command, size_t size) {
   } while (!acked);
 }
 
-static uint8_t* recv_packet(FILE *in, size_t *ret_size, bool* ret_sum_ok) {
+static uint8_t* recv_packet(struct gdb_conn *conn, size_t *ret_size, bool* ret_sum_ok) {
+  FILE *in = conn->in;
   size_t i = 0;
-  size_t size = 4096;
-  uint8_t *reply = malloc(size);
-  if (reply == NULL)
-    err(1, "malloc");
+  size_t size = conn->reply_size;
+  uint8_t *reply = conn->reply;
+  if (reply == NULL) {
+    size = 4096;
+    reply = malloc(size);
+    if (reply == NULL)
+      err(1, "malloc");
+  }
 
   int c;
   uint8_t sum = 0;
@@ -219,6 +228,8 @@ static uint8_t* recv_packet(FILE *in, size_t *ret_size, bool* ret_sum_ok) {
         }
         reply[i] = '\0';
 
+        conn->reply = reply;
+        conn->reply_size = (i == size ? size + 1 : size);
         return reply;
 
       case '}': // escape: next char is XOR 0x20
@@ -286,7 +297,7 @@ uint8_t* gdb_recv(struct gdb_conn *conn, size_t *size) {
   uint8_t *reply;
   bool acked = false;
   do {
-    reply = recv_packet(conn->in, size, &acked);
+    reply = recv_packet(conn, size, &acked);
 
     if (!conn->ack)
       break;
@@ -306,7 +317,6 @@ const char* gdb_start_noack(struct gdb_conn *conn) {
   size_t size;
   uint8_t *reply = gdb_recv(conn, &size);
   bool ok = size == 2 && !strcmp((const char*)reply, "OK");
-  free(reply);
 
   if (ok)
     conn->ack = false;
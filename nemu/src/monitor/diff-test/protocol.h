@@ -43,6 +43,7 @@ void gdb_end(struct gdb_conn *conn);
 
 void gdb_send(struct gdb_conn *conn, const uint8_t *command, size_t size);
 
+// the reply is valid until the next call, and should not be freed
 uint8_t *gdb_recv(struct gdb_conn *conn, size_t *size);
 
 const char * gdb_start_noack(struct gdb_conn *conn);
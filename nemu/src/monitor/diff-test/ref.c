@@ -0,0 +1,89 @@
+#ifdef DIFF_REF
+
+/* NEMU as a reference model for differential testing, see ref.h.
+ * It is built as a shared library by `make ref', without devices and
+ * with all symbols hidden except for the interface below.
+ */
+
+#include "nemu.h"
+#include "cpu/rtl.h"
+#include "cpu/decode-cache.h"
+#include "cpu/tb.h"
+#include "ref.h"
+
+#define REF_API __attribute__((visibility("default")))
+
+void init_pmem_map();
+void init_flat_table();
+void init_dcache();
+void init_tb();
+void exec_wrapper(bool);
+
+REF_API void difftest_ref_init() {
+  init_pmem_map();
+
+  cpu.eflags.val = 0x2;
+  cpu.cc.op = LAZY_CC_NONE;
+
+#ifdef THREADED_DISPATCH
+  init_flat_table();
+#endif
+  init_dcache();
+  init_tb();
+}
+
+REF_API void difftest_ref_memcpy(paddr_t dest, void *src, int len) {
+  memcpy(guest_to_host(dest), src, len);
+  pmem_touch(dest, len);
+}
+
+REF_API void difftest_ref_getregs(DiffRegs *regs) {
+  eflags_materialize();
+  int i;
+  for (i = R_EAX; i <= R_EDI; i ++) {
+    regs->gpr[i] = reg_l(i);
+  }
+  regs->eip = cpu.eip;
+  regs->eflags = cpu.eflags.val;
+}
+
+REF_API void difftest_ref_setregs(DiffRegs *regs) {
+  int i;
+  for (i = R_EAX; i <= R_EDI; i ++) {
+    reg_l(i) = regs->gpr[i];
+  }
+  cpu.eip = regs->eip;
+  cpu.eflags.val = regs->eflags;
+  cpu.cc.op = LAZY_CC_NONE;
+}
+
+REF_API void difftest_ref_exec(uint64_t n) {
+  while (n --) {
+    exec_wrapper(false);
+  }
+}
+
+REF_API uint64_t difftest_ref_memhash() {
+  return mem_write_hash;
+}
+
+static CPU_state cpu_checkpoint;
+static uint64_t hash_checkpoint;
+
+REF_API void difftest_ref_checkpoint() {
+  cpu_checkpoint = cpu;
+  hash_checkpoint = mem_write_hash;
+  mem_checkpoint();
+}
+
+REF_API void difftest_ref_rewind() {
+  mem_rewind();
+  cpu = cpu_checkpoint;
+  mem_write_hash = hash_checkpoint;
+
+  tlb_flush();
+  dcache_flush();
+  tb_flush();
+}
+
+#endif
@@ -0,0 +1,43 @@
+#ifndef __DIFF_TEST_REF_H__
+#define __DIFF_TEST_REF_H__
+
+#include "common.h"
+
+/* The registers checked by differential testing. */
+typedef struct {
+  uint32_t gpr[8];
+  uint32_t eip;
+  uint32_t eflags;
+} DiffRegs;
+
+/* A reference model which NEMU is checked against, instruction by
+ * instruction. `setregs' is always given the registers from `getregs'
+ * with the checked ones updated, so other registers are kept.
+ *
+ * Checking every instruction against nemu-ref.so runs at about 5 MIPS on
+ * a loop of movs and stores, with or without DEBUG. --diff-batch checks
+ * less often.
+ *
+ * The rest is optional and used by batched checking: `memhash' returns
+ * the sum of hashes of the stores executed, see mem_write_hash, and
+ * `rewind' restores the state saved by the last `checkpoint'.
+ */
+typedef struct {
+  const char *name;
+  void (*init)(void);
+  void (*memcpy)(paddr_t, void *, int);
+  void (*getregs)(DiffRegs *);
+  void (*setregs)(DiffRegs *);
+  void (*exec)(uint64_t);
+  uint64_t (*memhash)(void);
+  void (*checkpoint)(void);
+  void (*rewind)(void);
+} DiffRef;
+
+/* A reference model can be a shared library, which exports the functions
+ * of DiffRef with names starting with this prefix. NEMU itself is built
+ * as one by `make ref'.
+ */
+#define DIFF_REF_PREFIX "difftest_ref_"
+
+#endif
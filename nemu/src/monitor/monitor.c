@@ -1,21 +1,51 @@
 #include "nemu.h"
+#include "monitor/monitor.h"
+#include "cpu/rtl.h"
+#include "monitor/trace.h"
+#include "device/event.h"
+#include "device/replay.h"
+#include "monitor/snapshot.h"
+#include "monitor/symbol.h"
+#include "monitor/prof.h"
+#include "monitor/perf.h"
+#include <stdlib.h>
 #include <unistd.h>
+#include <getopt.h>
 
-#define ENTRY_START 0x100000
-
-void init_difftest();
+void init_difftest(const char *, int);
 void init_regex();
 void init_wp_pool();
 void init_device();
+void init_pmem_map();
+void init_flat_table();
+void init_dcache();
+void init_tb();
+void init_snapshot();
 
 void reg_test();
-void init_qemu_reg();
-bool gdb_memcpy_to_qemu(uint32_t, void *, int);
+void difftest_sync_reg();
+void difftest_memcpy_to_ref(paddr_t, void *, int);
 
 FILE *log_fp = NULL;
 static char *log_file = NULL;
 static char *img_file = NULL;
+static char *elf_file = NULL;
+static char *prof_folded = NULL;
+static char *perf_json = NULL;
+static int prof_period = -1;
+static char *trace_file = NULL;
+static char *replay_file = NULL;
+static char *snapshot_file = NULL;
+static char *diff_ref = NULL;
+static int diff_batch = 0;
+static int replay_file_mode = REPLAY_OFF;
 static int is_batch_mode = false;
+extern bool tb_mode;
+extern bool jit_mode;
+extern int server_jobs;
+extern bool vga_headless;
+extern const char *frame_dump;
+extern int frame_interval;
 
 static inline void init_log() {
 #ifdef DEBUG
@@ -74,32 +104,106 @@ static inline void load_img() {
     fclose(fp);
   }
 
+  pmem_touch(ENTRY_START, size);
+
 #ifdef DIFF_TEST
-  gdb_memcpy_to_qemu(ENTRY_START, guest_to_host(ENTRY_START), size);
+  difftest_memcpy_to_ref(ENTRY_START, guest_to_host(ENTRY_START), size);
 #endif
 }
 
+/* The image `x.bin' is built from the ELF file `x', which is also
+ * disassembled to `x.txt', see nexus-am/am/arch/x86-nemu/img/build.
+ */
+static inline void load_symbols() {
+  if (elf_file != NULL) {
+    Assert(load_elf_symbols(elf_file), "Can not load symbols from '%s'", elf_file);
+    return;
+  }
+
+  int len = (img_file != NULL ? strlen(img_file) : 0);
+  if (len <= 4 || strcmp(img_file + len - 4, ".bin") != 0) { return; }
+
+  char file[len + 1];
+  strcpy(file, img_file);
+  file[len - 4] = '\0';
+  if (load_elf_symbols(file)) {
+    Log("Symbols are loaded from %s", file);
+    return;
+  }
+  strcpy(file + len - 4, ".txt");
+  if (load_objdump_symbols(file)) {
+    Log("Symbols are loaded from %s", file);
+  }
+}
+
 static inline void restart() {
   /* Set the initial instruction pointer. */
   cpu.eip = ENTRY_START;
 
+  /* The value of EFLAGS after reset, with the flags evaluated. */
+  cpu.eflags.val = 0x2;
+  cpu.cc.op = LAZY_CC_NONE;
+
 #ifdef DIFF_TEST
-  init_qemu_reg();
+  difftest_sync_reg();
 #endif
 }
 
 static inline void parse_args(int argc, char *argv[]) {
+  const struct option table[] = {
+    {"icount", optional_argument, NULL, 'I'},
+    {"record", required_argument, NULL, 'R'},
+    {"replay", required_argument, NULL, 'P'},
+    {"load", required_argument, NULL, 'L'},
+    {"server", optional_argument, NULL, 'S'},
+    {"diff", required_argument, NULL, 'D'},
+    {"diff-batch", required_argument, NULL, 'B'},
+    {"elf", required_argument, NULL, 'E'},
+    {"prof", optional_argument, NULL, 'F'},
+    {"prof-folded", required_argument, NULL, 'O'},
+    {"perf-json", required_argument, NULL, 'J'},
+    {"headless", no_argument, NULL, 'H'},
+    {"frame-dump", required_argument, NULL, 'V'},
+    {"frame-interval", required_argument, NULL, 'N'},
+    {0, 0, NULL, 0},
+  };
   int o;
-  while ( (o = getopt(argc, argv, "-bl:")) != -1) {
+  while ( (o = getopt_long(argc, argv, "-btjl:T:", table, NULL)) != -1) {
     switch (o) {
       case 'b': is_batch_mode = true; break;
+      case 't': tb_mode = true; break;
+      case 'j': tb_mode = jit_mode = true; break;
       case 'l': log_file = optarg; break;
+      case 'T': trace_file = optarg; break;
+      case 'I':
+                icount_mips = (optarg != NULL ? atoi(optarg) : ICOUNT_DEFAULT_MIPS);
+                Assert(icount_mips > 0, "invalid MIPS rate '%s'", optarg);
+                break;
+      case 'R': replay_file = optarg; replay_file_mode = REPLAY_RECORD; break;
+      case 'P': replay_file = optarg; replay_file_mode = REPLAY_PLAY; break;
+      case 'L': snapshot_file = optarg; break;
+      case 'S': server_jobs = (optarg != NULL ? atoi(optarg) : 1); break;
+      case 'D': diff_ref = optarg; break;
+      case 'E': elf_file = optarg; break;
+      case 'F':
+                prof_period = (optarg != NULL ? atoi(optarg) : 0);
+                Assert(prof_period >= 0, "invalid sampling period '%s'", optarg);
+                break;
+      case 'O': prof_folded = optarg; break;
+      case 'J': perf_json = optarg; break;
+      case 'H': vga_headless = true; break;
+      case 'V': frame_dump = optarg; break;
+      case 'N': frame_interval = atoi(optarg); break;
+      case 'B':
+                diff_batch = atoi(optarg);
+                Assert(diff_batch > 0, "invalid batch size '%s'", optarg);
+                break;
       case 1:
                 if (img_file != NULL) Log("too much argument '%s', ignored", optarg);
                 else img_file = optarg;
                 break;
       default:
-                panic("Usage: %s [-b] [-l log_file] [img_file]", argv[0]);
+                panic("Usage: %s [-b] [-t] [-j] [-l log_file] [-T trace_file] [--icount[=MIPS]] [--record=log | --replay=log] [--load=snapshot] [--server[=jobs]] [--diff=qemu|ref.so] [--diff-batch=N] [--elf=elf_file] [--prof[=period]] [--prof-folded=file] [--perf-json=file] [--headless] [--frame-dump=pattern] [--frame-interval=N] [img_file]", argv[0]);
     }
   }
 }
@@ -113,28 +217,83 @@ int init_monitor(int argc, char *argv[]) {
   /* Open the log file. */
   init_log();
 
+  /* Count how NEMU performs, reporting to a JSON file at the end. */
+  init_perf(perf_json);
+
+  /* Start the instruction trace. */
+  if (trace_file != NULL) {
+    init_trace(trace_file);
+    if (jit_mode) {
+      Log("JIT code does not record the instruction trace, blocks are interpreted");
+      jit_mode = false;
+    }
+  }
+
   /* Test the implementation of the `CPU_state' structure. */
   reg_test();
 
 #ifdef DIFF_TEST
-  /* Fork a child process to perform differential testing. */
-  init_difftest();
+  /* Start the reference model to perform differential testing. */
+  init_difftest(diff_ref, diff_batch);
+#else
+  if (diff_ref != NULL || diff_batch > 0) {
+    Log("Differential testing is not enabled, '--diff' and '--diff-batch' are ignored");
+  }
 #endif
 
+  /* Build the physical memory map. */
+  init_pmem_map();
+
   /* Load the image to memory. */
   load_img();
 
+  /* Load the symbols of the program for expressions and the profiler. */
+  load_symbols();
+
   /* Initialize this virtual computer system. */
   restart();
 
+  /* Start the profiler after the entry is set. */
+  if (prof_period >= 0) {
+    init_prof(prof_period, prof_folded);
+  }
+
   /* Compile the regular expressions. */
   init_regex();
 
   /* Initialize the watchpoint pool. */
   init_wp_pool();
 
+#ifdef THREADED_DISPATCH
+  /* Flatten the opcode tables for the threaded dispatcher. */
+  init_flat_table();
+#endif
+
+  /* Initialize the decode cache and the translation blocks. */
+  init_dcache();
+  init_tb();
+
+  /* Collect the machine state for snapshots, devices add theirs. */
+  init_snapshot();
+
   /* Initialize devices. */
   init_device();
+#ifndef HAS_IOE
+  if (vga_headless || frame_dump != NULL) {
+    Log("There is no screen without HAS_IOE, '--headless' and '--frame-dump' are ignored");
+  }
+#endif
+
+  /* Start from a snapshot. */
+  if (snapshot_file != NULL) {
+    bool ok = snapshot_load(snapshot_file);
+    Assert(ok, "Can not load the snapshot '%s'", snapshot_file);
+  }
+
+  /* Record or replay the device input. */
+  if (replay_file != NULL) {
+    init_replay(replay_file, replay_file_mode);
+  }
 
   /* Display welcome message. */
   welcome();
@@ -0,0 +1,142 @@
+#include "nemu.h"
+#include "monitor/monitor.h"
+#include "monitor/trace.h"
+#include "device/event.h"
+#include "device/replay.h"
+
+#include <inttypes.h>
+#include <stdlib.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/wait.h>
+
+/* Server mode. After booting, NEMU reads jobs from stdin, one per line:
+ *
+ *   image_file [max_instr [load_addr]]
+ *
+ * Each job runs in a forked child, which shares the booted memory
+ * copy-on-write and only loads the image, at ENTRY_START by default.
+ * Boot to the interesting point with --load to share more. The child
+ * reports one line to stdout:
+ *
+ *   image_file GOOD|BAD|ABORT|TIMEOUT trap_code instr_count
+ *
+ * ABORT is for programs which end without nemu_trap or can not be loaded,
+ * and CRASH, with the signal, for children killed by failed assertions.
+ */
+
+#define MAX_SERVER_JOBS 64
+
+int server_jobs = 0;
+
+static struct {
+  pid_t pid;
+  char file[256];
+} slots[MAX_SERVER_JOBS];
+
+/* the original stdout, children send their results to it */
+static int result_fd = -1;
+
+static void report(const char *file, const char *result, int code, uint64_t n) {
+  char line[512];
+  int len = snprintf(line, sizeof(line), "%s %s %d %" PRIu64 "\n", file, result, code, n);
+  /* one write for each line, so that lines of children are not mixed */
+  if (write(result_fd, line, len) != len) { _exit(1); }
+}
+
+static bool load_job(const char *file, paddr_t addr) {
+  FILE *fp = fopen(file, "rb");
+  if (fp == NULL || addr >= PMEM_SIZE) { return false; }
+
+  size_t size = fread(guest_to_host(addr), 1, PMEM_SIZE - addr, fp);
+  fclose(fp);
+  pmem_touch(addr, size);
+  return size > 0;
+}
+
+static void run_job(const char *file, uint64_t max_instr, paddr_t addr) {
+  /* the messages of NEMU are not interesting here */
+  int null_fd = open("/dev/null", O_WRONLY);
+  dup2(null_fd, STDOUT_FILENO);
+  close(null_fd);
+
+  if (!load_job(file, addr)) {
+    report(file, "ABORT", -1, 0);
+    _exit(0);
+  }
+
+  void cpu_exec(uint64_t);
+  uint64_t icount_start = icount;
+  cpu_exec(max_instr);
+  fflush(stdout);
+
+  const char *result = (nemu_state != NEMU_END ? "TIMEOUT" :
+      !nemu_trap_hit ? "ABORT" : nemu_trap_code == 0 ? "GOOD" : "BAD");
+  report(file, result, nemu_trap_code, icount - icount_start);
+  _exit(0);
+}
+
+/* Wait for a child and free its slot. */
+static void wait_job() {
+  int status;
+  pid_t pid = wait(&status);
+  if (pid < 0) { return; }
+
+  int i;
+  for (i = 0; i < server_jobs; i ++) {
+    if (slots[i].pid == pid) {
+      if (!WIFEXITED(status)) {
+        report(slots[i].file, "CRASH", WIFSIGNALED(status) ? WTERMSIG(status) : -1, 0);
+      }
+      slots[i].pid = 0;
+      return;
+    }
+  }
+}
+
+void server_mainloop() {
+  Assert(server_jobs > 0 && server_jobs <= MAX_SERVER_JOBS,
+      "the number of parallel jobs should be in [1, %d]", MAX_SERVER_JOBS);
+  /* children can not share them */
+  Assert(!trace_enabled && replay_mode == REPLAY_OFF,
+      "the server mode does not work with the instruction trace or record/replay");
+#ifdef DIFF_TEST
+  panic("the server mode does not work with differential testing");
+#endif
+
+  fflush(stdout);
+  result_fd = dup(STDOUT_FILENO);
+
+  char line[512];
+  int running = 0;
+  while (fgets(line, sizeof(line), stdin) != NULL) {
+    char file[256];
+    uint64_t max_instr = -1;
+    int addr = ENTRY_START;
+    if (sscanf(line, "%255s %" SCNu64 " %i", file, &max_instr, &addr) < 1) { continue; }
+
+    if (running == server_jobs) {
+      wait_job();
+      running --;
+    }
+
+    int i;
+    for (i = 0; slots[i].pid != 0; i ++);
+    strcpy(slots[i].file, file);
+
+    fflush(stdout);
+    pid_t pid = fork();
+    Assert(pid >= 0, "Can not fork a child for '%s'", file);
+    if (pid == 0) {
+      run_job(file, max_instr, addr);
+    }
+
+    slots[i].pid = pid;
+    running ++;
+  }
+
+  while (running > 0) {
+    wait_job();
+    running --;
+  }
+}
@@ -0,0 +1,219 @@
+#include "nemu.h"
+#include "monitor/snapshot.h"
+#include "memory/mmu.h"
+#include "cpu/decode-cache.h"
+#include "cpu/tb.h"
+#include "device/event.h"
+#include "device/replay.h"
+
+#include <stdlib.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+
+#define NR_REGION 32
+#define NR_PAGE (PMEM_SIZE / PAGE_SIZE)
+
+typedef struct {
+  char name[SNAPSHOT_NAME_LEN];
+  void *addr;
+  uint32_t size;
+} Region;
+
+static Region regions[NR_REGION];
+static int nr_region = 0;
+
+/* Register a piece of machine state. The registered regions are saved
+ * in order, so they must be registered in the same order in every run.
+ */
+void add_snapshot_region(const char *name, void *addr, uint32_t size) {
+  assert(nr_region < NR_REGION);
+  Region *r = &regions[nr_region ++];
+  strncpy(r->name, name, SNAPSHOT_NAME_LEN - 1);
+  r->addr = addr;
+  r->size = size;
+}
+
+void init_snapshot() {
+  add_snapshot_region("cpu", &cpu, sizeof(cpu));
+  add_snapshot_region("icount", &icount, sizeof(icount));
+}
+
+bool snapshot_save(const char *file) {
+  /* write to a temporary file first, the old snapshot may still be mapped */
+  char tmp[256];
+  snprintf(tmp, sizeof(tmp), "%s.tmp", file);
+  FILE *fp = fopen(tmp, "wb");
+  if (fp == NULL) {
+    printf("Can not open '%s'\n", tmp);
+    return false;
+  }
+
+  static uint32_t pages[NR_PAGE];
+  uint32_t nr_page = 0, i;
+  for (i = 0; i < NR_PAGE; i ++) {
+    if (pmem_page_dirty[i]) { pages[nr_page ++] = i; }
+  }
+
+  SnapshotHeader h = {
+    .magic = SNAPSHOT_MAGIC, .version = SNAPSHOT_VERSION, .pmem_size = PMEM_SIZE,
+    .nr_region = nr_region, .nr_page = nr_page
+  };
+  long offset = sizeof(h) + nr_page * sizeof(pages[0]);
+  for (i = 0; i < nr_region; i ++) {
+    offset += sizeof(SnapshotRegion) + regions[i].size;
+  }
+  h.data_offset = (offset + PAGE_SIZE - 1) & ~PAGE_MASK;
+
+  bool ok = (fwrite(&h, sizeof(h), 1, fp) == 1);
+  for (i = 0; i < nr_region; i ++) {
+    SnapshotRegion r = { .size = regions[i].size };
+    memcpy(r.name, regions[i].name, SNAPSHOT_NAME_LEN);
+    ok = ok && fwrite(&r, sizeof(r), 1, fp) == 1 &&
+      fwrite(regions[i].addr, regions[i].size, 1, fp) == 1;
+  }
+  ok = ok && fwrite(pages, sizeof(pages[0]), nr_page, fp) == nr_page;
+  ok = ok && fseek(fp, h.data_offset, SEEK_SET) == 0;
+  for (i = 0; i < nr_page; i ++) {
+    ok = ok && fwrite(guest_to_host(pages[i] * PAGE_SIZE), PAGE_SIZE, 1, fp) == 1;
+  }
+
+  ok = (fclose(fp) == 0) && ok;
+  if (!ok || rename(tmp, file) != 0) {
+    printf("Can not write the snapshot to '%s'\n", file);
+    unlink(tmp);
+    return false;
+  }
+
+  Log("Saved %d pages to '%s'", nr_page, file);
+  return true;
+}
+
+/* Replace pages [first, first + n) of memory with pages of the snapshot
+ * at `offset', or with zero pages if `fd' is -1.
+ */
+static void map_pages(uint32_t first, uint32_t n, int fd, off_t offset) {
+  if (n == 0) { return; }
+
+  void *host = guest_to_host(first * PAGE_SIZE);
+  void *p = mmap(host, n * PAGE_SIZE, PROT_READ | PROT_WRITE,
+      MAP_PRIVATE | MAP_FIXED | (fd == -1 ? MAP_ANONYMOUS : 0), fd, offset);
+  Assert(p == host, "Can not map pages of the snapshot");
+
+#ifdef DIFF_TEST
+  void difftest_memcpy_to_ref(paddr_t, void *, int);
+  difftest_memcpy_to_ref(first * PAGE_SIZE, host, n * PAGE_SIZE);
+#endif
+}
+
+static bool snapshot_check(bool cond, const char *file) {
+  if (!cond) { printf("'%s' is not a snapshot of this machine\n", file); }
+  return cond;
+}
+
+bool snapshot_load(const char *file) {
+  if (replay_mode != REPLAY_OFF) {
+    printf("Can not load a snapshot when recording or replaying the device input\n");
+    return false;
+  }
+
+  FILE *fp = fopen(file, "rb");
+  if (fp == NULL) {
+    printf("Can not open '%s'\n", file);
+    return false;
+  }
+
+  /* check the whole file before changing the machine */
+  SnapshotHeader h;
+  uint8_t *data = NULL;
+  uint32_t *pages = NULL;
+  uint32_t i;
+  bool ok = fread(&h, sizeof(h), 1, fp) == 1 &&
+    h.magic == SNAPSHOT_MAGIC && h.version == SNAPSHOT_VERSION &&
+    h.pmem_size == PMEM_SIZE && h.nr_region == nr_region && h.nr_page <= NR_PAGE;
+
+  uint32_t data_size = 0;
+  for (i = 0; i < nr_region; i ++) {
+    data_size += regions[i].size;
+  }
+  data = malloc(data_size);
+  pages = malloc(NR_PAGE * sizeof(pages[0]));
+  assert(data != NULL && pages != NULL);
+
+  uint8_t *p = data;
+  for (i = 0; ok && i < nr_region; i ++) {
+    SnapshotRegion r;
+    ok = fread(&r, sizeof(r), 1, fp) == 1 &&
+      strncmp(r.name, regions[i].name, SNAPSHOT_NAME_LEN) == 0 && r.size == regions[i].size &&
+      fread(p, r.size, 1, fp) == 1;
+    p += r.size;
+  }
+
+  ok = ok && fread(pages, sizeof(pages[0]), h.nr_page, fp) == h.nr_page;
+  for (i = 0; ok && i < h.nr_page; i ++) {
+    ok = pages[i] < NR_PAGE && (i == 0 || pages[i] > pages[i - 1]);
+  }
+  ok = ok && (h.data_offset & PAGE_MASK) == 0 && fseek(fp, 0, SEEK_END) == 0 &&
+    ftell(fp) >= (long)h.data_offset + (long)h.nr_page * PAGE_SIZE;
+
+  if (!snapshot_check(ok, file)) {
+    fclose(fp);
+    free(data);
+    free(pages);
+    return false;
+  }
+
+  p = data;
+  for (i = 0; i < nr_region; i ++) {
+    memcpy(regions[i].addr, p, regions[i].size);
+    p += regions[i].size;
+  }
+
+  /* Pages in the snapshot are mapped copy-on-write from the file, and
+   * written pages which are not in it are replaced with zero pages.
+   */
+  int fd = fileno(fp);
+  uint32_t k = 0, run = 0, zero_run = 0;
+  for (i = 0; i < NR_PAGE; i ++) {
+    bool saved = (k < h.nr_page && pages[k] == i);
+    bool zero = (!saved && pmem_page_dirty[i]);
+
+    if (!saved && run > 0) {
+      map_pages(i - run, run, fd, h.data_offset + (off_t)(k - run) * PAGE_SIZE);
+      run = 0;
+    }
+    if (!zero && zero_run > 0) {
+      map_pages(i - zero_run, zero_run, -1, 0);
+      zero_run = 0;
+    }
+
+    if (saved) { run ++; k ++; }
+    if (zero) { zero_run ++; }
+    pmem_page_dirty[i] = saved;
+  }
+  map_pages(i - run, run, fd, h.data_offset + (off_t)(k - run) * PAGE_SIZE);
+  map_pages(i - zero_run, zero_run, -1, 0);
+
+  fclose(fp);
+  free(data);
+  free(pages);
+
+  /* everything cached about the old memory is stale */
+  tlb_flush();
+  dcache_flush();
+  tb_flush();
+  event_restore();
+
+#ifdef HAS_IOE
+  void vga_invalidate();
+  vga_invalidate();
+#endif
+
+#ifdef DIFF_TEST
+  void difftest_sync_reg();
+  difftest_sync_reg();
+#endif
+
+  Log("Loaded %d pages from '%s'", h.nr_page, file);
+  return true;
+}
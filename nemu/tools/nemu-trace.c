@@ -0,0 +1,179 @@
+/* Dump the binary instruction trace written by `nemu -T' as text.
+ *
+ * The trace only records the address and the raw bytes of every executed
+ * instruction. Distinct instructions are collected in a first pass and
+ * disassembled together by one run of objdump, then the trace is printed in
+ * a second pass, in the same layout as the instruction log of NEMU.
+ */
+
+#include "monitor/trace.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#define ASM_SIZE 80
+
+typedef struct {
+  TraceRecord r;
+  uint32_t offset;   // offset in the blob given to objdump
+  char assembly[ASM_SIZE];
+  int used;
+} Instr;
+
+static Instr *instrs = NULL;
+static uint32_t nr_slot = 0, nr_instr = 0;
+
+static uint32_t hash(const TraceRecord *r) {
+  uint32_t h = r->eip * 2654435761u;
+  int i;
+  for (i = 0; i < r->len && i < TRACE_INSTR_MAX; i ++) {
+    h = (h ^ r->instr[i]) * 16777619u;
+  }
+  return h;
+}
+
+static int same(const TraceRecord *a, const TraceRecord *b) {
+  return a->eip == b->eip && a->len == b->len &&
+    memcmp(a->instr, b->instr, a->len < TRACE_INSTR_MAX ? a->len : TRACE_INSTR_MAX) == 0;
+}
+
+static Instr* lookup(const TraceRecord *r) {
+  uint32_t i = hash(r) & (nr_slot - 1);
+  while (instrs[i].used && !same(&instrs[i].r, r)) {
+    i = (i + 1) & (nr_slot - 1);
+  }
+  return &instrs[i];
+}
+
+static void insert(const TraceRecord *r);
+
+static void grow() {
+  Instr *old = instrs;
+  uint32_t old_slot = nr_slot, i;
+
+  nr_slot = (nr_slot == 0 ? 4096 : nr_slot * 2);
+  instrs = calloc(nr_slot, sizeof(Instr));
+  if (instrs == NULL) { perror("calloc"); exit(1); }
+
+  nr_instr = 0;
+  for (i = 0; i < old_slot; i ++) {
+    if (old[i].used) { insert(&old[i].r); }
+  }
+  free(old);
+}
+
+static void insert(const TraceRecord *r) {
+  if ((nr_instr + 1) * 2 > nr_slot) { grow(); }
+
+  Instr *p = lookup(r);
+  if (!p->used) {
+    p->r = *r;
+    p->used = 1;
+    strcpy(p->assembly, "???");
+    nr_instr ++;
+  }
+}
+
+static FILE* open_trace(const char *file) {
+  FILE *fp = fopen(file, "rb");
+  if (fp == NULL) { perror(file); exit(1); }
+
+  TraceHeader h;
+  if (fread(&h, sizeof(h), 1, fp) != 1 || h.magic != TRACE_MAGIC || h.version != TRACE_VERSION) {
+    fprintf(stderr, "%s: not a NEMU instruction trace\n", file);
+    exit(1);
+  }
+  return fp;
+}
+
+/* Relative branch targets are printed by objdump as addresses in the blob.
+ * Rebase them onto the address of the instruction.
+ */
+static void rebase_target(Instr *p, char *text) {
+  int is_branch = (text[0] == 'j' || strncmp(text, "call", 4) == 0 || strncmp(text, "loop", 4) == 0);
+  char *target = strrchr(text, ' ');
+  if (!is_branch || target == NULL || strncmp(target + 1, "0x", 2) != 0) { return; }
+
+  uint32_t addr = strtoul(target + 1, NULL, 16) - p->offset + p->r.eip;
+  snprintf(target + 1, ASM_SIZE - (target + 1 - text), "0x%x", addr);
+}
+
+/* Put every distinct instruction into one flat binary and disassemble it. */
+static void disassemble() {
+  char blob[] = "/tmp/nemu-trace-XXXXXX";
+  int fd = mkstemp(blob);
+  if (fd < 0) { perror("mkstemp"); exit(1); }
+  FILE *fp = fdopen(fd, "wb");
+
+  uint32_t offset = 0, i;
+  Instr **by_offset = calloc(nr_instr, sizeof(Instr *));
+  uint32_t nr = 0;
+  for (i = 0; i < nr_slot; i ++) {
+    Instr *p = &instrs[i];
+    if (!p->used) { continue; }
+    int len = p->r.len < TRACE_INSTR_MAX ? p->r.len : TRACE_INSTR_MAX;
+    p->offset = offset;
+    fwrite(p->r.instr, 1, len, fp);
+    offset += len;
+    by_offset[nr ++] = p;
+  }
+  fclose(fp);
+
+  char cmd[256];
+  snprintf(cmd, sizeof(cmd), "objdump -D -b binary -m i386 --no-show-raw-insn %s 2>/dev/null", blob);
+  FILE *pipe = popen(cmd, "r");
+  if (pipe != NULL) {
+    /* instructions are written in the order of by_offset[] */
+    char line[512];
+    uint32_t k = 0;
+    while (fgets(line, sizeof(line), pipe) != NULL) {
+      uint32_t off;
+      int n;
+      if (sscanf(line, " %x:%n", &off, &n) != 1 || line[n] != '\t') { continue; }
+      while (k < nr && by_offset[k]->offset < off) { k ++; }
+      if (k == nr || by_offset[k]->offset != off) { continue; }
+
+      char *text = line + n + 1;
+      text[strcspn(text, "\n")] = '\0';
+      snprintf(by_offset[k]->assembly, ASM_SIZE, "%s", text);
+      rebase_target(by_offset[k], by_offset[k]->assembly);
+    }
+    pclose(pipe);
+  }
+
+  unlink(blob);
+  free(by_offset);
+}
+
+int main(int argc, char *argv[]) {
+  if (argc != 2) {
+    fprintf(stderr, "Usage: %s trace_file\n", argv[0]);
+    return 1;
+  }
+
+  FILE *fp = open_trace(argv[1]);
+  TraceRecord r;
+  while (fread(&r, sizeof(r), 1, fp) == 1) {
+    insert(&r);
+  }
+
+  if (nr_instr == 0) { return 0; }
+  disassemble();
+
+  fclose(fp);
+  fp = open_trace(argv[1]);
+  while (fread(&r, sizeof(r), 1, fp) == 1) {
+    Instr *p = lookup(&r);
+    int len = r.len < TRACE_INSTR_MAX ? r.len : TRACE_INSTR_MAX;
+    int i, col = printf("%8x:   ", r.eip);
+    for (i = 0; i < len; i ++) {
+      col += printf("%02x ", r.instr[i]);
+    }
+    printf("%*s%s\n", col < 50 ? 50 - col : 1, "", p->assembly);
+  }
+  fclose(fp);
+
+  return 0;
+}
@@ -49,6 +49,18 @@ enum {
   _EVENTS(_EVENT_NAME)
 };
 
+#define _PERF_EVENTS(_) \
+  _(INSTR) _(CYCLES) _(TLB_MISS) _(INTR) _(PIO) _(MMIO)
+
+#define _PERF_EVENT_NAME(ev) _PERF_##ev,
+
+enum {
+  _PERF_NONE = 0,
+  _PERF_EVENTS(_PERF_EVENT_NAME)
+};
+
+#define _NR_PERF_COUNTER 4
+
 typedef struct _RegSet _RegSet;
 
 typedef struct _Event {
@@ -87,6 +99,10 @@ int _read_key();
 void _draw_rect(const uint32_t *pixels, int x, int y, int w, int h);
 void _draw_sync();
 extern _Screen _screen;
+uint64_t _perf_instret();
+uint64_t _perf_cycles();
+void _perf_event(int counter, int event);
+uint64_t _perf_read(int counter);
 
 // =======================================================================
 // [2] Asynchronous Extension (ASYE)
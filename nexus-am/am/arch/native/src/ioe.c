@@ -20,3 +20,21 @@ void _ioe_init() {
 }
 
 
+
+/* the host has no counters for the program, only the clock */
+uint64_t _perf_instret() {
+  return 0;
+}
+
+uint64_t _perf_cycles() {
+  struct timeval now;
+  gettimeofday(&now, NULL);
+  return ((now.tv_sec - boot_time.tv_sec) * 1000000ull + now.tv_usec - boot_time.tv_usec) * 1000;
+}
+
+void _perf_event(int counter, int event) {
+}
+
+uint64_t _perf_read(int counter) {
+  return 0;
+}
@@ -2,6 +2,14 @@
 #include <x86.h>
 
 #define RTC_PORT 0x48   // Note that this is not standard
+#define PMU_PORT 0x50   // Note that this is not standard
+#define PMU_SELECT (PMU_PORT + 0x0)
+#define PMU_EVENT  (PMU_PORT + 0x4)
+#define PMU_LO     (PMU_PORT + 0x8)
+#define PMU_HI     (PMU_PORT + 0xc)
+#define PMU_INSTRET  0
+#define PMU_CYCLES   1
+#define PMU_COUNTER0 2
 static unsigned long boot_time;
 
 void _ioe_init() {
@@ -42,3 +50,27 @@ void _draw_sync() {
 int _read_key() {
   return _KEY_NONE;
 }
+
+static uint64_t pmu_read(int counter) {
+  outl(PMU_SELECT, counter);
+  uint32_t lo = inl(PMU_LO);   // latches the high half
+  uint32_t hi = inl(PMU_HI);
+  return ((uint64_t)hi << 32) | lo;
+}
+
+uint64_t _perf_instret() {
+  return pmu_read(PMU_INSTRET);
+}
+
+uint64_t _perf_cycles() {
+  return pmu_read(PMU_CYCLES);
+}
+
+void _perf_event(int counter, int event) {
+  outl(PMU_SELECT, PMU_COUNTER0 + counter);
+  outl(PMU_EVENT, event);
+}
+
+uint64_t _perf_read(int counter) {
+  return pmu_read(PMU_COUNTER0 + counter);
+}
@@ -0,0 +1,59 @@
+#include <am.h>
+#include <klib.h>
+
+#define N 100000
+#define K 10
+
+__attribute__((noinline, noclone))
+static void loop() {
+  volatile int i;
+  for (i = 0; i < N; i ++) ;
+}
+
+__attribute__((noinline, noclone))
+static void nop() {
+}
+
+/* Count the instructions of f() with the instret counter and with counter 0.
+ * Both also count some instructions of reading the counters, which are the
+ * same whatever f() is, so they cancel out by subtracting the count of nop().
+ */
+__attribute__((noinline, noclone))
+static uint64_t by_instret(void (*f)()) {
+  uint64_t start = _perf_instret();
+  f();
+  return _perf_instret() - start;
+}
+
+__attribute__((noinline, noclone))
+static uint64_t by_counter(void (*f)()) {
+  _perf_event(0, _PERF_INSTR);
+  f();
+  return _perf_read(0);
+}
+
+int main(){
+  _ioe_init();
+
+  uint32_t instr = by_instret(loop) - by_instret(nop);
+  printf("%d instructions for %d iterations, %d per iteration.\n", instr, N, instr / N);
+  assert(instr >= N);
+
+  uint32_t counted = by_counter(loop) - by_counter(nop);
+  printf("counter 0 counts %d instructions.\n", counted);
+  assert(counted == instr);
+
+  /* Each read of a counter is 3 accesses to the ports. The last read is
+   * counted up to its second access, which latches the counter.
+   */
+  _perf_event(1, _PERF_PIO);
+  int k;
+  for (k = 0; k < K; k ++) {
+    _perf_instret();
+  }
+  uint32_t pio = _perf_read(1);
+  printf("counter 1 counts %d port accesses for %d reads.\n", pio, K);
+  assert(pio == 3 * K + 2);
+
+  return 0;
+}